@@ -0,0 +1,50 @@
+#! /bin/bash
+# Compare hogwild LightLDA, whose workers update shared word-topic rows in
+# place, with document parallel LightLDA, whose workers keep thread local
+# deltas merged after each iteration.
+#
+# usage: hogwild.sh CORPUS [K] [ITERATIONS] [THREADS...]
+# For each # of threads and mode, it prints the best wall and CPU time of
+# 3 runs, and the log likelihood per word after training from another run,
+# as computing it takes long with concurrent rows.
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 CORPUS [K] [ITERATIONS] [THREADS...]"
+  exit 1
+fi
+
+lda_train=$(dirname $0)/../lda-train
+corpus=$1
+K=${2:-1000}
+iterations=${3:-20}
+shift $(($# < 3 ? $# : 3))
+threads_list=${@:-"8 16 32"}
+output=$(mktemp -d)
+trap "rm -rf $output" EXIT
+
+printf "%8s %8s %10s %10s %12s\n" threads hogwild wall cpu llh/word
+for threads in $threads_list; do
+  for hogwild in 0 1; do
+    options="-sampler lightlda -K $K -total_iteration $iterations
+        -burnin_iteration 0 -threads $threads -hogwild $hogwild
+        -model_format text"
+    for run in 1 2 3; do
+      TIMEFORMAT="%R %U %S"
+      { time $lda_train $options -log_likelihood_interval 0 $corpus \
+          $output/model >/dev/null 2>$output/log; } 2>>$output/times || {
+        tail -1 $output/log
+        exit 1
+      }
+    done
+    $lda_train $options -log_likelihood_interval $iterations $corpus \
+        $output/model >/dev/null 2>$output/log
+    llh=$(sed -n 's/.*LogLikelihood(total\/word)=.*\/\(.*\)\.$/\1/p' \
+        $output/log | tail -1)
+    awk -v threads=$threads -v hogwild=$hogwild -v llh="$llh" '
+        NR == 1 || $1 < wall { wall = $1 }
+        NR == 1 || $2 + $3 < cpu { cpu = $2 + $3 }
+        END { printf "%8d %8d %9.2fs %9.2fs %12s\n",
+              threads, hogwild, wall, cpu, llh }' $output/times
+    rm -f $output/times
+  done
+done
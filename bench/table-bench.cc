@@ -0,0 +1,100 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// count table microbenchmarks
+//
+
+#include <stdio.h>
+#include <chrono>
+#include <random>
+#include <vector>
+#include "table.h"
+
+namespace {
+
+// Each step moves a random word of a random row to a new topic,
+// like a sampler does: Dec the old topic, Count the new one, Inc it.
+// Rows have "L" words with topics in [0, K).
+struct Steps {
+  std::vector<int> rows;
+  std::vector<int> words;
+  std::vector<int> topics;
+};
+
+void MakeSteps(int R, int L, int K, int size, Steps* steps) {
+  std::mt19937 engine(1);
+  steps->rows.resize(size);
+  steps->words.resize(size);
+  steps->topics.resize(size);
+  for (int i = 0; i < size; i++) {
+    steps->rows[i] = static_cast<int>(engine() % R);
+    steps->words[i] = static_cast<int>(engine() % L);
+    steps->topics[i] = static_cast<int>(engine() % K);
+  }
+}
+
+// return ns per Inc, Dec or Count
+template <class Tables>
+double Run(int R, int L, int K, const Steps& steps) {
+  std::mt19937 engine(2);
+  std::vector<int> topics(static_cast<size_t>(R) * L);
+  Tables tables;
+  tables.Init(R, K);
+  for (int r = 0; r < R; r++) {
+    auto& row = tables[r];
+    row.Reserve(L);
+    for (int j = 0; j < L; j++) {
+      const int k = static_cast<int>(engine() % K);
+      topics[static_cast<size_t>(r) * L + j] = k;
+      ++row[k];
+    }
+  }
+
+  const int size = static_cast<int>(steps.rows.size());
+  long long sum = 0;
+  const auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; i < size; i++) {
+    const int r = steps.rows[i];
+    int& topic = topics[static_cast<size_t>(r) * L + steps.words[i]];
+    auto& row = tables[r];
+    const int k = steps.topics[i];
+    row.Dec(topic, 1);
+    sum += row.Count(k);
+    row.Inc(k, 1);
+    topic = k;
+  }
+  const auto end = std::chrono::steady_clock::now();
+  // keep "sum" alive
+  if (sum < 0) {
+    printf("%lld\n", sum);
+  }
+  return std::chrono::duration<double, std::nano>(end - begin).count() /
+         (3.0 * size);
+}
+
+}  // namespace
+
+int main() {
+  const int R = 20000;
+  const int kSteps = 10000000;
+  const int configs[][2] = {
+      {200, 4}, {200, 20}, {1000, 20}, {1000, 100}, {10000, 300},
+  };
+
+  printf("ns per Inc/Dec/Count on %d rows of L words\n", R);
+  printf("%6s %4s %10s %10s %12s %12s\n", "K", "L", "hash", "sparse",
+         "count_sorted", "hybrid_hash");
+  for (const auto& config : configs) {
+    const int K = config[0];
+    const int L = config[1];
+    Steps steps;
+    MakeSteps(R, L, K, kSteps, &steps);
+    const double hash = Run<HashTables>(R, L, K, steps);
+    const double sparse = Run<SparseTables>(R, L, K, steps);
+    const double count_sorted = Run<CountSortedTables>(R, L, K, steps);
+    const double hybrid_hash = Run<HybridHashTables>(R, L, K, steps);
+    printf("%6d %4d %10.1f %10.1f %12.1f %12.1f\n", K, L, hash, sparse,
+           count_sorted, hybrid_hash);
+  }
+  return 0;
+}
@@ -12,24 +12,29 @@
 class AliasBuilder;
 
 template <typename Float>
-class AliasT {
-  friend class AliasBuilder;
+struct AliasItemT {
+  Float prob;
+  int index;
+};
 
+// read-only alias table in memory owned by others,
+// e.g. a memory mapped file
+template <typename Float>
+class AliasViewT {
  public:
   typedef Float FloatType;
+  typedef AliasItemT<Float> AliasItem;
 
  private:
-  struct AliasItem {
-    FloatType prob;
-    int index;
-  };
-  std::vector<AliasItem> table_;
+  const AliasItem* table_;
   int size_;
 
  public:
-  AliasT() : size_(0) {}
+  AliasViewT() : table_(nullptr), size_(0) {}
+  AliasViewT(const AliasItem* table, int size) : table_(table), size_(size) {}
 
   int size() const { return size_; }
+  const AliasItem* table() const { return table_; }
 
   // thread safe and reenterable
   // "u1" is uniform in [0, 1)
@@ -51,6 +56,40 @@ class AliasT {
   }
 };
 
+template <typename Float>
+class AliasT {
+  friend class AliasBuilder;
+
+ public:
+  typedef Float FloatType;
+  typedef AliasItemT<Float> AliasItem;
+
+ private:
+  std::vector<AliasItem> table_;
+  int size_;
+
+ public:
+  AliasT() : size_(0) {}
+
+  int size() const { return size_; }
+  const AliasItem* table() const { return table_.data(); }
+  AliasViewT<Float> view() const { return AliasViewT<Float>(table(), size_); }
+
+  // thread safe and reenterable
+  // "u1" is uniform in [0, 1)
+  template <typename Float1>
+  int Sample(Float1 u1) const {
+    return view().Sample(u1);
+  }
+
+  // thread safe and reenterable
+  // "u1", "u2" are both uniform in [0, 1)
+  template <typename Float1, typename Float2>
+  int Sample(Float1 u1, Float2 u2) const {
+    return view().Sample(u1, u2);
+  }
+};
+
 class AliasBuilder {
  private:
   std::vector<int> small_;
@@ -62,17 +101,23 @@ class AliasBuilder {
   template <typename Float1, typename Float2>
   void Build(AliasT<Float1>* alias, std::vector<Float2>* prob,
              Float2 prob_sum) {
-    typedef typename AliasT<Float1>::AliasItem AliasItem;
-    std::vector<AliasItem>& table = alias->table_;
-    const size_t prob_size = prob->size();
-    if (table.size() != prob_size) {
-      table.resize(prob_size);
-      small_.resize(prob_size);
-      large_.resize(prob_size);
+    const int size = static_cast<int>(prob->size());
+    alias->table_.resize(size);
+    alias->size_ = size;
+    Build(alias->table_.data(), prob, prob_sum);
+  }
+
+  // Build into "table[0, prob->size())".
+  template <typename Float1, typename Float2>
+  void Build(AliasItemT<Float1>* table, std::vector<Float2>* prob,
+             Float2 prob_sum) {
+    typedef AliasItemT<Float1> AliasItem;
+    const int size = static_cast<int>(prob->size());
+    if (static_cast<int>(small_.size()) < size) {
+      small_.resize(size);
+      large_.resize(size);
     }
 
-    int& size = alias->size_;
-    size = static_cast<int>(prob_size);
     for (int i = 0; i < size; ++i) {
       (*prob)[i] *= (size / prob_sum);
     }
@@ -114,6 +159,10 @@ class AliasBuilder {
 };
 
 // use "AliasF" to save memory
+typedef AliasItemT<float> AliasItemF;
+typedef AliasItemT<double> AliasItemD;
+typedef AliasViewT<float> AliasViewF;
+typedef AliasViewT<double> AliasViewD;
 typedef AliasT<float> AliasF;
 typedef AliasT<double> AliasD;
 
@@ -0,0 +1,70 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "alias_file.h"
+#include <string.h>
+#include "x.h"
+
+const char kAliasFileMagic[8] = {'L', 'D', 'A', 'A', 'L', 'I', 'A', 'S'};
+const int kAliasFileVersion = 1;
+
+int64_t AliasFileSize(int V, int K, int64_t nnz) {
+  return static_cast<int64_t>(sizeof(AliasFileHeader)) +
+         static_cast<int64_t>(sizeof(double)) * V +
+         static_cast<int64_t>(sizeof(AliasItemD)) * K +
+         static_cast<int64_t>(sizeof(AliasItemF)) * nnz;
+}
+
+AliasFile::AliasFile()
+    : words_sum_(nullptr), beta_alias_(nullptr), words_alias_(nullptr) {
+  memset(&header_, 0, sizeof(header_));
+}
+
+bool AliasFile::Open(const std::string& filename) {
+  Close();
+  if (!file_.Open(filename)) {
+    return false;
+  }
+
+  if (file_.size() < sizeof(header_)) {
+    ERROR("\"%s\" is too small.", filename.c_str());
+    Close();
+    return false;
+  }
+  memcpy(&header_, file_.data(), sizeof(header_));
+  if (memcmp(header_.magic, kAliasFileMagic, sizeof(header_.magic)) != 0) {
+    ERROR("\"%s\" is not an alias file.", filename.c_str());
+    Close();
+    return false;
+  }
+  if (header_.version != kAliasFileVersion) {
+    ERROR("\"%s\" has version %d, but %d is required.", filename.c_str(),
+          header_.version, kAliasFileVersion);
+    Close();
+    return false;
+  }
+  if (header_.V <= 0 || header_.K <= 0 || header_.nnz < 0 ||
+      static_cast<int64_t>(file_.size()) !=
+          AliasFileSize(header_.V, header_.K, header_.nnz)) {
+    ERROR("\"%s\" has a bad header or size.", filename.c_str());
+    Close();
+    return false;
+  }
+
+  const char* p = file_.data() + sizeof(header_);
+  words_sum_ = reinterpret_cast<const double*>(p);
+  p += sizeof(double) * header_.V;
+  beta_alias_ = reinterpret_cast<const AliasItemD*>(p);
+  p += sizeof(AliasItemD) * header_.K;
+  words_alias_ = reinterpret_cast<const AliasItemF*>(p);
+  return true;
+}
+
+void AliasFile::Close() {
+  file_.Close();
+  memset(&header_, 0, sizeof(header_));
+  words_sum_ = nullptr;
+  beta_alias_ = nullptr;
+  words_alias_ = nullptr;
+}
@@ -0,0 +1,64 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// precomputed word proposals of a binary LDA model
+//
+
+#ifndef ALIAS_FILE_H_
+#define ALIAS_FILE_H_
+
+#include <stdint.h>
+#include <string>
+#include "alias.h"
+#include "mapped_file.h"
+
+// alias file layout, in native byte order:
+// AliasFileHeader,
+// double words_sum[V], sums of sparse parts of word proposals,
+// AliasItemD beta_alias[K], the dense part shared by all words,
+// AliasItemF words_alias[nnz], sparse parts of word proposals,
+// in the same CSR form as entries of the model.
+struct AliasFileHeader {
+  char magic[8];
+  int32_t version;
+  int32_t V;
+  int32_t K;
+  int32_t reserved;
+  int64_t nnz;
+  uint64_t model_digest;  // "ModelFile::Digest" of the model
+  double beta_sum;
+};
+
+extern const char kAliasFileMagic[8];
+extern const int kAliasFileVersion;
+
+// Return the size of an alias file with these dimensions.
+int64_t AliasFileSize(int V, int K, int64_t nnz);
+
+// read-only mapped alias file,
+// processes mapping the same file share its pages
+class AliasFile {
+ private:
+  MappedFile file_;
+  AliasFileHeader header_;
+  const double* words_sum_;
+  const AliasItemD* beta_alias_;
+  const AliasItemF* words_alias_;
+
+ public:
+  AliasFile();
+
+  bool Open(const std::string& filename);
+  void Close();
+
+  int V() const { return header_.V; }
+  int K() const { return header_.K; }
+  int64_t nnz() const { return header_.nnz; }
+  uint64_t model_digest() const { return header_.model_digest; }
+  double beta_sum() const { return header_.beta_sum; }
+  const double* words_sum() const { return words_sum_; }
+  const AliasItemD* beta_alias() const { return beta_alias_; }
+  const AliasItemF* words_alias() const { return words_alias_; }
+};
+
+#endif  // ALIAS_FILE_H_
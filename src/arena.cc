@@ -0,0 +1,99 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "arena.h"
+
+RowArena::RowArena() : clearing_(false) {}
+
+int RowArena::SizeClass(size_t* size) {
+  // multiples of 16 up to 256 bytes: classes [0, 16),
+  // then 4 classes in each (2^n, 2^(n+1)]
+  if (*size <= 256) {
+    const size_t n = (*size + 15) >> 4;
+    *size = (n ? n : 1) << 4;
+    return static_cast<int>(n ? n - 1 : 0);
+  }
+
+  int n = 8;
+  while ((static_cast<size_t>(2) << n) < *size) {
+    n++;
+  }
+  const size_t step = static_cast<size_t>(1) << (n - 2);
+  const size_t steps = (*size + step - 1) / step;  // in [5, 8]
+  *size = steps * step;
+  return 16 + (n - 8) * 4 + static_cast<int>(steps - 5);
+}
+
+RowArena::Shard& RowArena::ThreadShard() {
+  // threads take shards in turn, which are shared by all arenas
+  static std::atomic<int> next_shard(0);
+  thread_local int shard = next_shard.fetch_add(1) % kShards;
+  return shards_[shard];
+}
+
+char* RowArena::NewChunk() {
+  std::lock_guard<std::mutex> guard(chunks_mutex_);
+  chunks_.emplace_back(new char[kChunkSize]);
+  return chunks_.back().get();
+}
+
+void* RowArena::Allocate(size_t size) {
+  if (size > kMaxBlockSize) {
+    return ::operator new(size);
+  }
+
+  const int size_class = SizeClass(&size);
+  Shard& shard = ThreadShard();
+  std::lock_guard<std::mutex> guard(shard.mutex);
+  std::vector<void*>& free_lists = shard.free_lists;
+  if (size_class < static_cast<int>(free_lists.size()) &&
+      free_lists[size_class]) {
+    void* p = free_lists[size_class];
+    free_lists[size_class] = *static_cast<void**>(p);
+    return p;
+  }
+
+  if (shard.chunk_left < size) {
+    // the rest of the chunk is wasted, at most "kMaxBlockSize"
+    shard.chunk = NewChunk();
+    shard.chunk_left = kChunkSize;
+  }
+  void* p = shard.chunk;
+  shard.chunk += size;
+  shard.chunk_left -= size;
+  return p;
+}
+
+void RowArena::Deallocate(void* p, size_t size) {
+  if (size > kMaxBlockSize) {
+    ::operator delete(p);
+    return;
+  }
+  if (clearing_.load(std::memory_order_relaxed)) {
+    return;
+  }
+
+  const int size_class = SizeClass(&size);
+  Shard& shard = ThreadShard();
+  std::lock_guard<std::mutex> guard(shard.mutex);
+  std::vector<void*>& free_lists = shard.free_lists;
+  if (size_class >= static_cast<int>(free_lists.size())) {
+    free_lists.resize(size_class + 1, nullptr);
+  }
+  *static_cast<void**>(p) = free_lists[size_class];
+  free_lists[size_class] = p;
+}
+
+void RowArena::Clear() {
+  for (Shard& shard : shards_) {
+    std::lock_guard<std::mutex> guard(shard.mutex);
+    shard.chunk = nullptr;
+    shard.chunk_left = 0;
+    shard.free_lists.clear();
+  }
+  std::lock_guard<std::mutex> guard(chunks_mutex_);
+  chunks_.clear();
+  chunks_.shrink_to_fit();
+  clearing_.store(false, std::memory_order_relaxed);
+}
@@ -0,0 +1,120 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// arena of count table rows
+//
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+// Storage of many small rows carved from large chunks.
+// A freed block is kept in a free list of its size class, and reused by
+// rows of the same class, so a row grows in place within its block, or
+// relocates to another block inside the arena.
+// Blocks larger than "kMaxBlockSize" are allocated from the heap.
+// It is thread safe. Threads carve blocks from their own shards, each with
+// its own chunk, free lists and mutex, so workers rarely contend for a lock,
+// and a block freed by a thread is reused by the same thread.
+class RowArena {
+ private:
+  static const size_t kChunkSize = 1 << 20;
+  static const size_t kMaxBlockSize = 1 << 16;
+  static const int kShards = 16;
+
+  struct Shard {
+    std::mutex mutex;
+    char* chunk;  // unused part of the last chunk of the shard
+    size_t chunk_left;
+    std::vector<void*> free_lists;  // size class -> head of its free list
+    char padding[64];               // against false sharing of shards
+
+    Shard() : chunk(nullptr), chunk_left(0) {}
+  };
+
+  Shard shards_[kShards];
+  std::mutex chunks_mutex_;
+  std::vector<std::unique_ptr<char[]> > chunks_;
+  std::atomic<bool> clearing_;
+
+ public:
+  RowArena();
+  RowArena(const RowArena&) = delete;
+  RowArena& operator=(const RowArena&) = delete;
+
+  void* Allocate(size_t size);
+  void Deallocate(void* p, size_t size);
+
+  // Ignore deallocations of blocks in chunks until "Clear",
+  // so that rows destroyed right before it neither lock nor touch free lists.
+  void BeginClear() { clearing_.store(true, std::memory_order_relaxed); }
+  // Release all chunks at once,
+  // blocks of them must not be used or deallocated afterwards.
+  void Clear();
+
+ private:
+  // Return the size class of "size", and round "size" up to its block size.
+  static int SizeClass(size_t* size);
+  // the shard of the calling thread
+  Shard& ThreadShard();
+  char* NewChunk();
+};
+
+// std::allocator compatible allocator on a "RowArena",
+// or on the heap if the arena is nullptr.
+// Copies of containers use the heap, so that rows copied out of a table,
+// e.g. shadows of workers, never touch the arena.
+template <typename T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  ArenaAllocator() : arena_(nullptr) {}
+  explicit ArenaAllocator(RowArena* arena) : arena_(arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U>& right) : arena_(right.arena()) {}
+
+  RowArena* arena() const { return arena_; }
+
+  T* allocate(size_t n) {
+    if (arena_) {
+      return static_cast<T*>(arena_->Allocate(n * sizeof(T)));
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (arena_) {
+      arena_->Deallocate(p, n * sizeof(T));
+    } else {
+      ::operator delete(p);
+    }
+  }
+
+  ArenaAllocator select_on_container_copy_construction() const {
+    return ArenaAllocator();
+  }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& right) const {
+    return arena_ == right.arena();
+  }
+
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& right) const {
+    return arena_ != right.arena();
+  }
+
+ private:
+  RowArena* arena_;
+};
+
+#endif  // ARENA_H_
@@ -0,0 +1,62 @@
+// Copyright (c) 2015-2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// command line argument utilities
+//
+
+#ifndef ARGS_H_
+#define ARGS_H_
+
+#include <errno.h>
+#include <stdlib.h>
+#include "x.h"
+
+#define COMSUME_1_ARG(argc, argv, i)     \
+  do {                                   \
+    for (int j = i; j < argc - 1; j++) { \
+      argv[j] = argv[j + 1];             \
+    }                                    \
+    argc -= 1;                           \
+  } while (0)
+
+#define COMSUME_2_ARG(argc, argv, i)     \
+  do {                                   \
+    for (int j = i; j < argc - 2; j++) { \
+      argv[j] = argv[j + 2];             \
+    }                                    \
+    argc -= 2;                           \
+  } while (0)
+
+#define CHECK_MISSING_ARG(argc, argv, i, action)  \
+  do {                                            \
+    if (i + 1 == argc) {                          \
+      ERROR("\"%s\" requires a value.", argv[i]); \
+      action;                                     \
+    }                                             \
+  } while (0)
+
+inline double xatod(const char* str) {
+  char* endptr;
+  double d;
+  errno = 0;
+  d = strtod(str, &endptr);
+  if (errno != 0 || str == endptr) {
+    ERROR("\"%s\" is not a double.", str);
+    exit(1);
+  }
+  return d;
+}
+
+inline int xatoi(const char* str) {
+  char* endptr;
+  int i;
+  errno = 0;
+  i = static_cast<int>(strtol(str, &endptr, 10));
+  if (errno != 0 || str == endptr) {
+    ERROR("\"%s\" is not an integer.", str);
+    exit(1);
+  }
+  return i;
+}
+
+#endif  // ARGS_H_
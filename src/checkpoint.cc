@@ -0,0 +1,60 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "checkpoint.h"
+#include <stdio.h>
+#include <utility>
+#include "x.h"
+
+const char kCheckpointMagic[8] = {'L', 'D', 'A', 'C', 'K', 'P', 'T', '\0'};
+const int kCheckpointVersion = 2;
+
+namespace {
+
+bool WriteFile(const std::string& filename, const std::vector<char>& data) {
+  const std::string tmp_filename = filename + ".tmp";
+  FILE* file = fopen(tmp_filename.c_str(), "wb");
+  if (file == nullptr) {
+    ERROR("Failed to open \"%s\".", tmp_filename.c_str());
+    return false;
+  }
+
+  const size_t size = fwrite(&data[0], 1, data.size(), file);
+  const bool flushed = fflush(file) == 0;
+  fclose(file);
+  if (size != data.size() || !flushed) {
+    ERROR("Failed to write \"%s\".", tmp_filename.c_str());
+    remove(tmp_filename.c_str());
+    return false;
+  }
+
+  if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    ERROR("Failed to rename \"%s\" to \"%s\".", tmp_filename.c_str(),
+          filename.c_str());
+    remove(tmp_filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+void CheckpointWriter::Write(const std::string& filename,
+                             std::vector<char>&& data) {
+  Wait();
+  // a failed checkpoint is reported but does not stop training
+  writer_ = std::thread(
+      [filename](const std::vector<char>& data) {
+        if (WriteFile(filename, data)) {
+          INFO("Saved checkpoint \"%s\".", filename.c_str());
+        }
+      },
+      std::move(data));
+}
+
+void CheckpointWriter::Wait() {
+  if (writer_.joinable()) {
+    writer_.join();
+  }
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// sampler checkpoint file and its background writer
+//
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+// checkpoint layout, in native byte order:
+// CheckpointHeader,
+// double alpha[K],
+// "rngs" random number generator states, each is int32 size and chars,
+// Topic topics[N], topics of all words.
+// Counts are rebuilt from topics when resuming.
+struct CheckpointHeader {
+  char magic[8];
+  int32_t version;
+  int32_t topic_size;  // sizeof(Topic)
+  int32_t M;
+  int32_t V;
+  int32_t K;
+  int32_t iteration;  // the last finished iteration
+  int64_t N;
+  double hp_sum_alpha;
+  double hp_beta;
+  int32_t rngs;
+  int32_t layout;  // kCheckpoint* flags of word order
+};
+
+// Options that reorder words, and so which word each topic belongs to.
+// A checkpoint is only resumed with the same ones.
+enum {
+  kCheckpointRunLength = 1,
+  kCheckpointRemapWords = 2,
+  kCheckpointGroupWords = 4,
+};
+
+extern const char kCheckpointMagic[8];
+extern const int kCheckpointVersion;
+
+// A checkpoint is serialized into memory by the sampler,
+// and written on a background thread while sampling goes on.
+// The file is written to a temporary file and renamed,
+// so an interrupted write never destroys the last checkpoint.
+class CheckpointWriter {
+ private:
+  std::thread writer_;
+
+ public:
+  CheckpointWriter() {}
+  ~CheckpointWriter() { Wait(); }
+  CheckpointWriter(const CheckpointWriter&) = delete;
+  CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+  // Write "data" to "filename" in background,
+  // after the last write is finished.
+  void Write(const std::string& filename, std::vector<char>&& data);
+  // Wait for the last write.
+  void Wait();
+};
+
+#endif  // CHECKPOINT_H_
@@ -0,0 +1,439 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// lock-free concurrent count tables
+//
+
+#ifndef CONCURRENT_TABLE_H_
+#define CONCURRENT_TABLE_H_
+
+#include <stdint.h>
+#include <atomic>
+#include "table.h"
+#include "x.h"
+
+// Storage retired by growing concurrent tables.
+class RetiredStorage {
+ private:
+  friend class RetiredList;
+  RetiredStorage* retired_next_;
+
+ public:
+  RetiredStorage() : retired_next_(nullptr) {}
+  virtual ~RetiredStorage() {}
+};
+
+// Storage retired by rows of a matrix.
+// Other threads may still be reading it, so it is only freed by "Reclaim"
+// at a quiescent point of the matrix,
+// e.g. the end of an iteration, when no thread accesses its rows.
+class RetiredList {
+ private:
+  std::atomic<RetiredStorage*> head_;
+
+ public:
+  RetiredList() : head_(nullptr) {}
+  RetiredList(const RetiredList&) = delete;
+  RetiredList& operator=(const RetiredList&) = delete;
+  ~RetiredList() { Reclaim(); }
+
+  void Retire(RetiredStorage* storage) {
+    RetiredStorage* old_head = head_.load(std::memory_order_relaxed);
+    do {
+      storage->retired_next_ = old_head;
+    } while (!head_.compare_exchange_weak(old_head, storage,
+                                          std::memory_order_release,
+                                          std::memory_order_relaxed));
+  }
+
+  void Reclaim() {
+    RetiredStorage* storage = head_.exchange(nullptr);
+    while (storage) {
+      RetiredStorage* next = storage->retired_next_;
+      delete storage;
+      storage = next;
+    }
+  }
+};
+
+// A lock-free hash table for Hogwild style sampling.
+// A slot packs an id and its count into 64 bits and is claimed by CAS.
+// Inc/Dec are CAS loops on the slot.
+// Ids are never removed, a slot whose count drops to 0 is kept for reuse.
+// When the load factor exceeds 0.75, the table grows by migrating slots
+// into a storage twice as large. Any thread that meets the migration helps
+// to finish it. The old storage is retired to the list of the matrix,
+// see "ConcurrentHashTables".
+// A row out of a matrix, e.g. a copy, frees it at once,
+// so it must be used by one thread at a time.
+template <typename T>
+class ConcurrentHashTableT {
+ public:
+  typedef T ElementType;
+
+ private:
+  // slot layout: moved flag(1 bit), id(31 bits), count(32 bits)
+  static const uint64_t kMoved = 1ULL << 63;
+  static const int kEmptyID = 0x7fffffff;
+  static const uint64_t kEmptySlot = static_cast<uint64_t>(kEmptyID) << 32;
+  static const int kInitialCapacity = 8;
+
+  static uint64_t Pack(int id, ElementType count) {
+    return (static_cast<uint64_t>(id) << 32) |
+           static_cast<uint32_t>(static_cast<int32_t>(count));
+  }
+  static int SlotID(uint64_t slot) {
+    return static_cast<int>((slot >> 32) & kEmptyID);
+  }
+  static ElementType SlotCount(uint64_t slot) {
+    return static_cast<ElementType>(static_cast<int32_t>(slot & 0xffffffff));
+  }
+  static int Hash(int id) {
+    return static_cast<int>(static_cast<uint32_t>(id) * 2654435761u >> 1);
+  }
+
+  struct Storage : public RetiredStorage {
+    const int capacity;  // power of 2
+    std::atomic<int> claimed;
+    std::atomic<Storage*> next;
+    std::atomic<uint64_t>* slots;
+
+    explicit Storage(int _capacity)
+        : capacity(_capacity),
+          claimed(0),
+          next(nullptr),
+          slots(new std::atomic<uint64_t>[_capacity]) {
+      for (int i = 0; i < capacity; i++) {
+        slots[i].store(kEmptySlot, std::memory_order_relaxed);
+      }
+    }
+    virtual ~Storage() { delete[] slots; }
+  };
+
+  std::atomic<Storage*> storage_;
+  int hint_capacity_;
+  RetiredList* retired_;
+
+ public:
+  ConcurrentHashTableT()
+      : storage_(nullptr),
+        hint_capacity_(kInitialCapacity),
+        retired_(nullptr) {}
+
+  // not thread safe, the copy is out of any matrix
+  ConcurrentHashTableT(const ConcurrentHashTableT& right)
+      : storage_(nullptr),
+        hint_capacity_(right.hint_capacity_),
+        retired_(nullptr) {
+    CopyFrom(right);
+  }
+
+  // not thread safe, the retired list is kept
+  ConcurrentHashTableT& operator=(const ConcurrentHashTableT& right) {
+    if (this != &right) {
+      Clear();
+      hint_capacity_ = right.hint_capacity_;
+      CopyFrom(right);
+    }
+    return *this;
+  }
+
+  ~ConcurrentHashTableT() { Clear(); }
+
+  // Storage is retired and reclaimed independently of rows,
+  // so it is never allocated from "arena".
+  void Init(int hint_size, RowArena* arena = nullptr) {}
+  void Reserve(int size) {}
+  // storage retired by growth goes to "retired"
+  void set_retired(RetiredList* retired) { retired_ = retired; }
+
+  ElementType Inc(int id, ElementType count) {
+    static_assert(sizeof(ElementType) == 4, "32 bits counts are required");
+    DCHECK(id >= 0 && id < kEmptyID);
+    Storage* storage = storage_.load(std::memory_order_acquire);
+    if (storage == nullptr) {
+      storage = InitStorage();
+    }
+
+    ElementType result;
+    while (!Add(storage, id, count, &result)) {
+      storage = Migrate(storage);
+    }
+    return result;
+  }
+
+  ElementType Dec(int id, ElementType count) { return Inc(id, -count); }
+
+  ElementType Count(int id) const {
+    const Storage* storage = storage_.load(std::memory_order_acquire);
+    while (storage) {
+      const int mask = storage->capacity - 1;
+      int pos = Hash(id) & mask;
+      bool moved = false;
+      for (int i = 0; i < storage->capacity; i++) {
+        const uint64_t slot =
+            storage->slots[pos].load(std::memory_order_acquire);
+        if (slot & kMoved) {
+          moved = true;
+          break;
+        }
+
+        const int slot_id = SlotID(slot);
+        if (slot_id == kEmptyID) {
+          return 0;
+        }
+        if (slot_id == id) {
+          const ElementType count = SlotCount(slot);
+          // may be transiently negative while a row is being moved
+          return count > 0 ? count : 0;
+        }
+        pos = (pos + 1) & mask;
+      }
+
+      if (!moved) {
+        return 0;
+      }
+      storage = storage->next.load(std::memory_order_acquire);
+    }
+    return 0;
+  }
+
+  // Iterates the newest storage only, so slots not yet moved into it by a
+  // concurrent migration are missed, and counts may be stale under
+  // concurrent updates. It is exact at a quiescent point.
+  class const_iterator {
+   private:
+    const Storage* storage_;
+    int index_;
+
+    void SkipZero() {
+      if (storage_ == nullptr) {
+        return;
+      }
+      while (index_ < storage_->capacity) {
+        const uint64_t slot =
+            storage_->slots[index_].load(std::memory_order_relaxed);
+        if (SlotID(slot) != kEmptyID && SlotCount(slot) > 0) {
+          break;
+        }
+        index_++;
+      }
+    }
+
+   public:
+    const_iterator(const Storage* storage, int index)
+        : storage_(storage), index_(index) {
+      SkipZero();
+    }
+
+    int id() const {
+      return SlotID(storage_->slots[index_].load(std::memory_order_relaxed));
+    }
+
+    ElementType count() const {
+      const ElementType count =
+          SlotCount(storage_->slots[index_].load(std::memory_order_relaxed));
+      return count > 0 ? count : 0;
+    }
+
+    bool operator==(const const_iterator& right) const {
+      return storage_ == right.storage_ && index_ == right.index_;
+    }
+
+    bool operator!=(const const_iterator& right) const {
+      return !(storage_ == right.storage_ && index_ == right.index_);
+    }
+
+    const_iterator& operator++() {
+      index_++;
+      SkipZero();
+      return *this;
+    }
+  };
+
+  const_iterator begin() const { return const_iterator(Newest(), 0); }
+
+  const_iterator end() const {
+    const Storage* storage = Newest();
+    return const_iterator(storage, storage ? storage->capacity : 0);
+  }
+
+  class __Proxy {
+   private:
+    ConcurrentHashTableT* impl_;
+    int id_;
+
+   public:
+    __Proxy(ConcurrentHashTableT* impl, int id) : impl_(impl), id_(id) {}
+    ElementType operator++() { return impl_->Inc(id_, 1); }
+    ElementType operator+=(ElementType count) { return impl_->Inc(id_, count); }
+    ElementType operator--() { return impl_->Dec(id_, 1); }
+    ElementType operator-=(ElementType count) { return impl_->Dec(id_, count); }
+    operator ElementType() { return impl_->Count(id_); }
+  };
+
+  __Proxy operator[](int id) { return __Proxy(this, id); }
+  ElementType operator[](int id) const { return Count(id); }
+
+ private:
+  const Storage* Newest() const {
+    const Storage* storage = storage_.load(std::memory_order_acquire);
+    while (storage) {
+      const Storage* next = storage->next.load(std::memory_order_acquire);
+      if (next == nullptr) {
+        break;
+      }
+      storage = next;
+    }
+    return storage;
+  }
+
+  Storage* InitStorage() {
+    Storage* storage = new Storage(hint_capacity_);
+    Storage* expected = nullptr;
+    if (storage_.compare_exchange_strong(expected, storage)) {
+      return storage;
+    }
+    delete storage;
+    return expected;
+  }
+
+  // add "count" to "id" in "storage",
+  // return false if "storage" is full or being moved.
+  static bool Add(Storage* storage, int id, ElementType count,
+                  ElementType* result) {
+    const int mask = storage->capacity - 1;
+    const int max_claimed = (storage->capacity >> 1) + (storage->capacity >> 2);
+    int pos = Hash(id) & mask;
+    for (int i = 0; i < storage->capacity; i++) {
+      std::atomic<uint64_t>& slot = storage->slots[pos];
+      uint64_t old_slot = slot.load(std::memory_order_acquire);
+      for (;;) {
+        if (old_slot & kMoved) {
+          return false;
+        }
+
+        const int slot_id = SlotID(old_slot);
+        if (slot_id == kEmptyID) {
+          if (storage->claimed.load(std::memory_order_relaxed) >= max_claimed) {
+            return false;
+          }
+          if (slot.compare_exchange_weak(old_slot, Pack(id, count),
+                                         std::memory_order_acq_rel)) {
+            storage->claimed.fetch_add(1, std::memory_order_relaxed);
+            *result = count;
+            return true;
+          }
+          // "old_slot" is reloaded, check it again
+          continue;
+        }
+
+        if (slot_id != id) {
+          break;
+        }
+
+        const ElementType new_count = SlotCount(old_slot) + count;
+        if (slot.compare_exchange_weak(old_slot, Pack(id, new_count),
+                                       std::memory_order_acq_rel)) {
+          *result = new_count;
+          return true;
+        }
+      }
+      // linear probe
+      pos = (pos + 1) & mask;
+    }
+    return false;
+  }
+
+  // move all slots of "storage" to its successor, return the successor
+  Storage* Migrate(Storage* storage) {
+    Storage* next = storage->next.load(std::memory_order_acquire);
+    if (next == nullptr) {
+      Storage* new_storage = new Storage(storage->capacity << 1);
+      if (storage->next.compare_exchange_strong(next, new_storage)) {
+        next = new_storage;
+      } else {
+        delete new_storage;
+      }
+    }
+
+    for (int i = 0; i < storage->capacity; i++) {
+      std::atomic<uint64_t>& slot = storage->slots[i];
+      uint64_t old_slot = slot.load(std::memory_order_acquire);
+      while (!(old_slot & kMoved)) {
+        if (slot.compare_exchange_weak(old_slot, old_slot | kMoved,
+                                       std::memory_order_acq_rel)) {
+          const int id = SlotID(old_slot);
+          const ElementType count = SlotCount(old_slot);
+          if (id != kEmptyID && count != 0) {
+            Storage* target = next;
+            ElementType result;
+            while (!Add(target, id, count, &result)) {
+              target = Migrate(target);
+            }
+          }
+          break;
+        }
+      }
+    }
+
+    Storage* expected = storage;
+    if (storage_.compare_exchange_strong(expected, next)) {
+      if (retired_) {
+        retired_->Retire(storage);
+      } else {
+        delete storage;
+      }
+    }
+    return next;
+  }
+
+  void CopyFrom(const ConcurrentHashTableT& right) {
+    for (auto first = right.begin(), last = right.end(); first != last;
+         ++first) {
+      Inc(first.id(), first.count());
+    }
+  }
+
+  void Clear() {
+    Storage* storage = storage_.exchange(nullptr);
+    while (storage) {
+      Storage* next = storage->next.load();
+      delete storage;
+      storage = next;
+    }
+  }
+};
+
+typedef ConcurrentHashTableT<int> ConcurrentHashTable;
+
+// Rows retire storage to the list of their matrix,
+// so matrices of different samplers are reclaimed independently.
+class ConcurrentHashTables : public TablesT<ConcurrentHashTable> {
+ private:
+  typedef TablesT<ConcurrentHashTable> BaseType;
+  // rows never refer to retired storage, so it is freed before them
+  RetiredList retired_;
+
+ public:
+  void Init(int d1, int d2) {
+    retired_.Reclaim();
+    BaseType::Init(d1, d2);
+    for (int i = 0; i < d1; i++) {
+      (*this)[i].set_retired(&retired_);
+    }
+  }
+
+  // Free storage retired by rows,
+  // no thread may access them, e.g. all workers are quiescent.
+  void ReclaimRetiredStorage() { retired_.Reclaim(); }
+};
+
+// free storage retired by concurrent rows of "tables"
+template <class Tables>
+inline void ReclaimRetiredStorage(Tables* tables) {}
+inline void ReclaimRetiredStorage(ConcurrentHashTables* tables) {
+  tables->ReclaimRetiredStorage();
+}
+
+#endif  // CONCURRENT_TABLE_H_
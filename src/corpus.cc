@@ -3,113 +3,833 @@
 //
 
 #include "corpus.h"
+#include <stdint.h>
 #include <string.h>
+#include <algorithm>
 #include <fstream>
+#include <functional>
+#include <limits>
+#include <utility>
+#include "file_reader.h"
+#include "mapped_file.h"
 #include "x.h"
 
-#if defined _MSC_VER
-#define strtoll _strtoi64
+#if defined _OPENMP
+#include <omp.h>
 #endif
 
-bool Corpus::LoadCorpus(const std::string& filename, bool doc_with_id) {
-  std::ifstream ifs(filename.c_str());
-  if (!ifs.is_open()) {
-    ERROR("Failed to open \"%s\".", filename.c_str());
-    return false;
-  }
+namespace {
 
-  int line_no = 0;
-  char* endptr;
-  char* doc_id = nullptr;
-  char* word_id;
-  char* word_count;
-  char* word_begin;
-  Word word;
-  int n, index, id, i, count;
-  std::string line;
+// binary corpus layout, in native byte order:
+// BinaryCorpusHeader,
+// int32 docs[M + 1], doc starting indices in words, a sentinel at the end,
+// int32 words[N], word ids.
+const char kBinaryCorpusMagic[8] = {'L', 'D', 'A', 'C', 'O', 'R', 'P', 'S'};
+const int kBinaryCorpusVersion = 1;
 
-  INFO("Loading corpus from \"%s\".", filename.c_str());
-  V_ = 0;
+struct BinaryCorpusHeader {
+  char magic[8];
+  int32_t version;
+  int32_t M;
+  int32_t V;
+  int32_t reserved;
+  int64_t N;  // # of words
+};
 
-  while (std::getline(ifs, line)) {
-    line_no++;
-    index = static_cast<int>(words_.size());
-    n = 0;
+bool IsBinaryCorpus(const std::string& filename) {
+  std::ifstream ifs(filename.c_str(), std::ios::binary);
+  char magic[sizeof(kBinaryCorpusMagic)];
+  return ifs.read(magic, sizeof(magic)) &&
+         memcmp(magic, kBinaryCorpusMagic, sizeof(magic)) == 0;
+}
 
-    if (doc_with_id) {
-      doc_id = strtok(&line[0], " \t|\n");
-      if (doc_id == nullptr) {
-        continue;
-      }
-      word_begin = nullptr;
+// words and documents parsed from a range of lines
+struct ParsedRange {
+  std::vector<int> words;     // word ids
+  std::vector<int> counts;    // repeat counts of "words" if "run_length"
+  std::vector<int> doc_ends;  // doc ending indices in "words"
+  int V;
+  int lines;
+  // (line number in this range, message)
+  std::vector<std::pair<int, std::string> > errors;
+
+  ParsedRange() : V(0), lines(0) {}
+};
+
+bool IsDelimiter(char c) {
+  return c == ' ' || c == '\t' || c == '|' || c == '\n';
+}
+
+bool IsSpace(char c) {
+  return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Parse a base 10 integer in [begin, end) like "strtoll",
+// return false if [begin, end) is not fully consumed.
+bool ParseInteger(const char* begin, const char* end, int* value) {
+  const char* p = begin;
+  while (p != end && IsSpace(*p)) {
+    p++;
+  }
+
+  bool negative = false;
+  if (p != end && (*p == '+' || *p == '-')) {
+    negative = (*p == '-');
+    p++;
+  }
+
+  const char* digits = p;
+  unsigned long long u = 0;
+  bool overflow = false;
+  const unsigned long long limit =
+      negative ? 0x8000000000000000ULL : 0x7fffffffffffffffULL;
+  for (; p != end && *p >= '0' && *p <= '9'; p++) {
+    const unsigned digit = static_cast<unsigned>(*p - '0');
+    if (u > (limit - digit) / 10) {
+      overflow = true;
     } else {
-      word_begin = &line[0];
+      u = u * 10 + digit;
     }
+  }
+
+  if (p == digits) {
+    // no digits, nothing is consumed
+    *value = 0;
+    return begin == end;
+  }
 
+  long long ll;
+  if (overflow) {
+    ll = negative ? std::numeric_limits<long long>::min()
+                  : std::numeric_limits<long long>::max();
+  } else {
+    ll = negative ? static_cast<long long>(0 - u) : static_cast<long long>(u);
+  }
+  *value = static_cast<int>(ll);
+  return p == end;
+}
+
+// Tokens are separated by " \t|".
+// "id" or "id:count" are words, the first token is skipped if "doc_with_id".
+// "run_length" keeps repeated words of a document as (id, count) runs,
+// instead of repeating them.
+// Lines without words are skipped unless "keep_empty_docs".
+void ParseRange(const char* begin, const char* end, bool doc_with_id,
+                bool run_length, bool keep_empty_docs, ParsedRange* range) {
+  const char* p = begin;
+  while (p != end) {
+    const char* line_end =
+        static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+    if (line_end == nullptr) {
+      line_end = end;
+    }
+    range->lines++;
+
+    const size_t index = range->words.size();
+    bool skip = doc_with_id;
     for (;;) {
-      word_id = strtok(word_begin, " \t|\n");
-      word_begin = nullptr;
-      if (word_id == nullptr) {
+      while (p != line_end && IsDelimiter(*p)) {
+        p++;
+      }
+      if (p == line_end) {
         break;
       }
+      const char* word_id = p;
+      while (p != line_end && !IsDelimiter(*p)) {
+        p++;
+      }
+      const char* word_id_end = p;
+
+      if (skip) {
+        skip = false;
+        continue;
+      }
 
-      word_count = strrchr(word_id, ':');
-      if (word_count) {
-        if (word_count == word_id) {
-          ERROR("line %d, word id is empty.", line_no);
+      int count = 1;
+      const char* word_count = word_id_end;
+      while (word_count != word_id && word_count[-1] != ':') {
+        word_count--;
+      }
+      if (word_count != word_id) {
+        // "word_count" is after the last ':'
+        if (word_count - 1 == word_id) {
+          range->errors.push_back(
+              std::make_pair(range->lines, std::string("word id is empty.")));
           continue;
         }
-        *word_count = '\0';
-        word_count++;
-        count = static_cast<int>(strtoll(word_count, &endptr, 10));
-        if (*endptr != '\0') {
-          ERROR("line %d, word count error \"%s\".", line_no, word_count);
+        if (!ParseInteger(word_count, word_id_end, &count)) {
+          range->errors.push_back(std::make_pair(
+              range->lines, "word count error \"" +
+                                std::string(word_count, word_id_end) + "\"."));
           continue;
         }
-      } else {
-        count = 1;
+        word_id_end = word_count - 1;
       }
 
-      id = static_cast<int>(strtoll(word_id, &endptr, 10));
-      if (*endptr != '\0') {
-        ERROR("line %d, word id error \"%s\".", line_no, word_id);
+      int id;
+      if (!ParseInteger(word_id, word_id_end, &id)) {
+        range->errors.push_back(std::make_pair(
+            range->lines,
+            "word id error \"" + std::string(word_id, word_id_end) + "\"."));
         continue;
       }
       if (id < 0) {
-        ERROR("line %d, word id must be ge than 0.", line_no);
+        range->errors.push_back(std::make_pair(
+            range->lines, std::string("word id must be ge than 0.")));
         continue;
       }
 
-      if (id >= V_) {
-        V_ = id + 1;
+      if (id >= range->V) {
+        range->V = id + 1;
       }
-      word.v = id;
-      for (i = 0; i < count; i++) {
-        words_.push_back(word);
-        ++n;
+      if (!run_length) {
+        for (int i = 0; i < count; i++) {
+          range->words.push_back(id);
+        }
+      } else if (count > 0) {
+        if (range->words.size() != index && range->words.back() == id &&
+            range->counts.back() <= std::numeric_limits<int>::max() - count) {
+          range->counts.back() += count;
+        } else {
+          range->words.push_back(id);
+          range->counts.push_back(count);
+        }
       }
     }
 
-    if (n != 0) {
-      docs_.push_back(index);
+    if (range->words.size() != index || keep_empty_docs) {
+      range->doc_ends.push_back(static_cast<int>(range->words.size()));
+    }
+    if (p != end) {
+      // skip '\n'
+      p++;
+    }
+  }
+}
+
+// Split [data, data + size) into newline aligned ranges,
+// and parse them in parallel.
+void ParseText(const char* data, size_t size, bool doc_with_id,
+               bool run_length, bool keep_empty_docs,
+               std::vector<ParsedRange>* ranges) {
+#if defined _OPENMP
+  const int threads = omp_get_max_threads();
+#else
+  const int threads = 1;
+#endif
+
+  const char* data_end = data + size;
+  std::vector<const char*> boundaries(threads + 1, data_end);
+  boundaries[0] = data;
+  for (int t = 1; t < threads; t++) {
+    const char* begin = data + size / threads * t;
+    if (begin < boundaries[t - 1]) {
+      begin = boundaries[t - 1];
+    }
+    const char* newline =
+        begin == data_end
+            ? nullptr
+            : static_cast<const char*>(memchr(
+                  begin, '\n', static_cast<size_t>(data_end - begin)));
+    boundaries[t] = newline ? newline + 1 : data_end;
+  }
+
+  ranges->clear();
+  ranges->resize(threads);
+#if defined _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(threads)
+#endif
+  for (int t = 0; t < threads; t++) {
+    ParseRange(boundaries[t], boundaries[t + 1], doc_with_id, run_length,
+               keep_empty_docs, &(*ranges)[t]);
+  }
+}
+
+// report errors of "ranges" in order,
+// "line_offset" is # of lines before "ranges"
+void ReportErrors(const std::vector<ParsedRange>& ranges, int* line_offset) {
+  for (const ParsedRange& range : ranges) {
+    for (size_t i = 0; i < range.errors.size(); i++) {
+      ERROR("line %d, %s", *line_offset + range.errors[i].first,
+            range.errors[i].second.c_str());
     }
+    *line_offset += range.lines;
+  }
+}
+
+// Read a text corpus, which may be compressed, in chunks of whole lines,
+// and call "func(ranges)" with ranges parsed from each chunk.
+// Reading and decompression overlap with parsing.
+bool ParseTextFile(
+    const std::string& filename, bool doc_with_id, bool run_length,
+    bool keep_empty_docs,
+    const std::function<void(std::vector<ParsedRange>*)>& func) {
+  FileReader reader;
+  if (!reader.Open(filename)) {
+    return false;
   }
 
+  std::vector<char> chunk;
+  int line_offset = 0;
+  std::vector<ParsedRange> ranges;
+  for (bool more = true; more;) {
+    const char* data;
+    size_t size;
+    more = reader.Next(&data, &size);
+    if (more) {
+      chunk.insert(chunk.end(), data, data + size);
+    }
+
+    size_t end = chunk.size();
+    if (more) {
+      while (end > 0 && chunk[end - 1] != '\n') {
+        end--;
+      }
+      if (end == 0) {
+        // a line longer than the chunk
+        continue;
+      }
+    }
+
+    ParseText(chunk.data(), end, doc_with_id, run_length, keep_empty_docs,
+              &ranges);
+    ReportErrors(ranges, &line_offset);
+    func(&ranges);
+    chunk.erase(chunk.begin(), chunk.begin() + end);
+  }
+  return !reader.error();
+}
+
+// Validate a mapped binary corpus except word ids,
+// return its doc starting indices or nullptr.
+const int32_t* MapBinaryCorpus(const MappedFile& file,
+                               const std::string& filename,
+                               BinaryCorpusHeader* header) {
+  if (file.size() < sizeof(*header)) {
+    ERROR("\"%s\" is too small.", filename.c_str());
+    return nullptr;
+  }
+  memcpy(header, file.data(), sizeof(*header));
+  if (memcmp(header->magic, kBinaryCorpusMagic, sizeof(header->magic)) != 0) {
+    ERROR("\"%s\" is not a binary corpus.", filename.c_str());
+    return nullptr;
+  }
+  if (header->version != kBinaryCorpusVersion) {
+    ERROR("\"%s\" has version %d, but %d is required.", filename.c_str(),
+          header->version, kBinaryCorpusVersion);
+    return nullptr;
+  }
+  if (header->M <= 0 || header->V <= 0 || header->N <= 0 ||
+      header->N > 0x7fffffff) {
+    ERROR("\"%s\" has a bad header.", filename.c_str());
+    return nullptr;
+  }
+  const size_t docs_size = sizeof(int32_t) * (header->M + 1);
+  const size_t words_size = sizeof(int32_t) * static_cast<size_t>(header->N);
+  if (file.size() != sizeof(*header) + docs_size + words_size) {
+    ERROR("\"%s\" has a bad size.", filename.c_str());
+    return nullptr;
+  }
+
+  const int32_t* docs =
+      reinterpret_cast<const int32_t*>(file.data() + sizeof(*header));
+  if (docs[0] != 0 || docs[header->M] != header->N) {
+    ERROR("\"%s\" has bad doc indices.", filename.c_str());
+    return nullptr;
+  }
+  for (int m = 0; m < header->M; m++) {
+    if (docs[m] >= docs[m + 1]) {
+      ERROR("\"%s\" has bad doc indices.", filename.c_str());
+      return nullptr;
+    }
+  }
+  return docs;
+}
+
+}  // namespace
+
+bool Corpus::LoadCorpus(const std::string& filename, bool doc_with_id,
+                        bool run_length, bool keep_empty_docs) {
+  ClearRuns();
+  grouped_ = false;
+  if (IsBinaryCorpus(filename)) {
+    if (!LoadBinaryCorpus(filename)) {
+      return false;
+    }
+    if (run_length) {
+      MakeRuns();
+    }
+    return true;
+  }
+
+  FileReader::Format format;
+  if (!FileReader::GetFormat(filename, &format)) {
+    return false;
+  }
+
+  INFO("Loading corpus from \"%s\".", filename.c_str());
+  std::vector<ParsedRange> ranges;
+  if (format == FileReader::kPlain) {
+    MappedFile file;
+    if (!file.Open(filename)) {
+      return false;
+    }
+    ParseText(file.data(), file.size(), doc_with_id, run_length,
+              keep_empty_docs, &ranges);
+    int line_offset = 0;
+    ReportErrors(ranges, &line_offset);
+  } else {
+    auto func = [&ranges](std::vector<ParsedRange>* chunk_ranges) {
+      for (ParsedRange& range : *chunk_ranges) {
+        ranges.push_back(std::move(range));
+      }
+    };
+    if (!ParseTextFile(filename, doc_with_id, run_length, keep_empty_docs,
+                       func)) {
+      return false;
+    }
+  }
+  const int parts = static_cast<int>(ranges.size());
+
+  // concatenate ranges
+  std::vector<long long> word_offsets(parts + 1, 0);
+  std::vector<int> doc_offsets(parts + 1, 0);
+  V_ = 0;
+  for (int t = 0; t < parts; t++) {
+    const ParsedRange& range = ranges[t];
+    word_offsets[t + 1] = word_offsets[t] + range.words.size();
+    doc_offsets[t + 1] =
+        doc_offsets[t] + static_cast<int>(range.doc_ends.size());
+    if (range.V > V_) {
+      V_ = range.V;
+    }
+  }
+  if (word_offsets[parts] > std::numeric_limits<int>::max()) {
+    ERROR("Too many words %lld.", word_offsets[parts]);
+    return false;
+  }
+
+  M_ = doc_offsets[parts];
+  docs_.resize(M_ + 1);
+  words_buffer_.resize(static_cast<size_t>(word_offsets[parts]));
+#if defined _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+  for (int t = 0; t < parts; t++) {
+    const ParsedRange& range = ranges[t];
+    const int word_offset = static_cast<int>(word_offsets[t]);
+    std::copy(range.words.begin(), range.words.end(),
+              words_buffer_.begin() + word_offset);
+    int* docs = &docs_[0] + doc_offsets[t];
+    int doc_begin = 0;
+    for (size_t j = 0; j < range.doc_ends.size(); j++) {
+      docs[j] = word_offset + doc_begin;
+      doc_begin = range.doc_ends[j];
+    }
+  }
+  UseWordsBuffer();
   // a sentinel
-  index = static_cast<int>(words_.size());
-  docs_.push_back(index);
-  docs_.shrink_to_fit();
-  words_.shrink_to_fit();
+  docs_[M_] = N_;
+
+  if (run_length) {
+    // "words_buffer_" and "docs_" hold runs now
+    run_words_.swap(words_buffer_);
+    doc_runs_.swap(docs_);
+    run_counts_.reserve(run_words_.size());
+    for (const ParsedRange& range : ranges) {
+      run_counts_.insert(run_counts_.end(), range.counts.begin(),
+                         range.counts.end());
+    }
+    if (!MakeDocsFromRuns()) {
+      return false;
+    }
+  }
 
-  M_ = static_cast<int>(docs_.size()) - 1;
   if (M_ == 0) {
     ERROR("Loaded an empty corpus.");
     return false;
   }
-  if (V_ == 0) {
+  if (V_ == 0 && !keep_empty_docs) {
     ERROR("Loaded an empty vocabulary.");
     return false;
   }
   INFO("Loaded %d documents, %d unique words.", M_, V_);
+  if (run_length) {
+    INFO("Stored %d words in %d runs.", N_,
+         static_cast<int>(run_words_.size()));
+  }
+  return true;
+}
+
+bool Corpus::LoadBinaryCorpus(const std::string& filename) {
+  ClearRuns();
+  grouped_ = false;
+  if (!words_file_.Open(filename)) {
+    return false;
+  }
+
+  INFO("Loading binary corpus from \"%s\".", filename.c_str());
+  BinaryCorpusHeader header;
+  const int32_t* docs = MapBinaryCorpus(words_file_, filename, &header);
+  if (docs == nullptr) {
+    words_file_.Close();
+    return false;
+  }
+  const int32_t* words = docs + header.M + 1;
+
+  const int N = static_cast<int>(header.N);
+  int bad_words = 0;
+  for (int i = 0; i < N; i++) {
+    bad_words += (words[i] < 0 || words[i] >= header.V);
+  }
+  if (bad_words) {
+    ERROR("\"%s\" has %d bad word ids.", filename.c_str(), bad_words);
+    words_file_.Close();
+    return false;
+  }
+
+  docs_.assign(docs, docs + header.M + 1);
+  words_buffer_.clear();
+  words_buffer_.shrink_to_fit();
+  words_ = words;
+  M_ = header.M;
+  N_ = N;
+  V_ = header.V;
+  INFO("Loaded %d documents, %d unique words.", M_, V_);
+  return true;
+}
+
+bool Corpus::SetCorpus(const int* docs, int M, const int* words, int V,
+                       bool run_length) {
+  ClearRuns();
+  grouped_ = false;
+  if (M < 0 || V < 0 || (M > 0 && (docs == nullptr || docs[0] != 0))) {
+    ERROR("Bad documents.");
+    return false;
+  }
+  for (int m = 0; m < M; m++) {
+    if (docs[m] > docs[m + 1]) {
+      ERROR("Document %d has a bad range.", m);
+      return false;
+    }
+  }
+
+  const int N = M > 0 ? docs[M] : 0;
+  if (N == 0) {
+    ERROR("Set an empty corpus.");
+    return false;
+  }
+  int bad_words = 0;
+  for (int i = 0; i < N; i++) {
+    bad_words += (words[i] < 0 || words[i] >= V);
+  }
+  if (bad_words) {
+    ERROR("%d bad word ids.", bad_words);
+    return false;
+  }
+
+  words_file_.Close();
+  docs_.assign(docs, docs + M + 1);
+  words_buffer_.clear();
+  words_buffer_.shrink_to_fit();
+  words_ = words;
+  M_ = M;
+  N_ = N;
+  V_ = V;
+  word_ids_.clear();
+  INFO("Set %d documents, %d unique words.", M_, V_);
+  if (run_length) {
+    MakeRuns();
+  }
+  return true;
+}
+
+bool Corpus::ScanCorpus(const std::string& filename, bool doc_with_id,
+                        const std::function<void(const int*, int)>& func,
+                        int* V) {
+  *V = 0;
+  if (IsBinaryCorpus(filename)) {
+    MappedFile file;
+    if (!file.Open(filename)) {
+      return false;
+    }
+
+    INFO("Scanning binary corpus \"%s\".", filename.c_str());
+    BinaryCorpusHeader header;
+    const int32_t* docs = MapBinaryCorpus(file, filename, &header);
+    if (docs == nullptr) {
+      return false;
+    }
+    const int32_t* words = docs + header.M + 1;
+    for (int m = 0; m < header.M; m++) {
+      const int* doc = words + docs[m];
+      const int N = docs[m + 1] - docs[m];
+      for (int n = 0; n < N; n++) {
+        if (doc[n] < 0 || doc[n] >= header.V) {
+          ERROR("\"%s\" has a bad word id %d.", filename.c_str(), doc[n]);
+          return false;
+        }
+      }
+      func(doc, N);
+    }
+    *V = header.V;
+    return true;
+  }
+
+  INFO("Scanning corpus \"%s\".", filename.c_str());
+  auto parsed = [&func, V](std::vector<ParsedRange>* ranges) {
+    for (const ParsedRange& range : *ranges) {
+      int doc_begin = 0;
+      for (int doc_end : range.doc_ends) {
+        func(&range.words[doc_begin], doc_end - doc_begin);
+        doc_begin = doc_end;
+      }
+      if (range.V > *V) {
+        *V = range.V;
+      }
+    }
+  };
+  return ParseTextFile(filename, doc_with_id, false, false, parsed);
+}
+
+bool Corpus::SaveBinaryCorpus(const std::string& filename) const {
+  std::ofstream ofs(filename.c_str(), std::ios::binary);
+  if (!ofs.is_open()) {
+    ERROR("Failed to open \"%s\".", filename.c_str());
+    return false;
+  }
+
+  INFO("Saving binary corpus to \"%s\".", filename.c_str());
+  BinaryCorpusHeader header;
+  memcpy(header.magic, kBinaryCorpusMagic, sizeof(header.magic));
+  header.version = kBinaryCorpusVersion;
+  header.M = M_;
+  header.V = V_;
+  header.reserved = 0;
+  header.N = N_;
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(&docs_[0]),
+            sizeof(int32_t) * (M_ + 1));
+  if (!run_length_ && word_ids_.empty()) {
+    ofs.write(reinterpret_cast<const char*>(words_), sizeof(int32_t) * N_);
+  } else {
+    // expand runs, and save original word ids
+    std::vector<int> buffer, words;
+    for (int m = 0; m < M_; m++) {
+      const int* doc = DocWords(m, &buffer);
+      words.assign(doc, doc + docs_[m + 1] - docs_[m]);
+      if (!word_ids_.empty()) {
+        for (int& v : words) {
+          v = word_ids_[v];
+        }
+      }
+      ofs.write(reinterpret_cast<const char*>(words.data()),
+                sizeof(int32_t) * words.size());
+    }
+  }
+
+  if (!ofs) {
+    ERROR("Failed to write \"%s\".", filename.c_str());
+    return false;
+  }
+  INFO("Saved %d documents, %d words.", M_, N_);
+  return true;
+}
+
+void Corpus::PartitionDocs(int parts, std::vector<int>* boundaries) const {
+  const long long total = docs_[M_];
+  boundaries->resize(parts + 1);
+  (*boundaries)[0] = 0;
+  for (int p = 1; p < parts; p++) {
+    const long long target = total * p / parts;
+    (*boundaries)[p] = static_cast<int>(
+        std::lower_bound(docs_.begin(), docs_.begin() + M_, target) -
+        docs_.begin());
+  }
+  (*boundaries)[parts] = M_;
+}
+
+void Corpus::KeepDocs(int m_begin, int m_end) {
+  const int word_begin = docs_[m_begin];
+  const int word_end = docs_[m_end];
+  if (run_length_) {
+    const int run_begin = doc_runs_[m_begin];
+    const int run_end = doc_runs_[m_end];
+    run_words_.erase(run_words_.begin() + run_end, run_words_.end());
+    run_words_.erase(run_words_.begin(), run_words_.begin() + run_begin);
+    run_words_.shrink_to_fit();
+    run_counts_.erase(run_counts_.begin() + run_end, run_counts_.end());
+    run_counts_.erase(run_counts_.begin(), run_counts_.begin() + run_begin);
+    run_counts_.shrink_to_fit();
+    std::vector<int> doc_runs;
+    doc_runs.reserve(m_end - m_begin + 1);
+    for (int m = m_begin; m <= m_end; m++) {
+      doc_runs.push_back(doc_runs_[m] - run_begin);
+    }
+    doc_runs_.swap(doc_runs);
+    N_ = word_end - word_begin;
+  } else if (words_buffer_.empty()) {
+    // mapped or caller owned
+    words_ += word_begin;
+    N_ = word_end - word_begin;
+  } else {
+    words_buffer_.erase(words_buffer_.begin() + word_end,
+                        words_buffer_.end());
+    words_buffer_.erase(words_buffer_.begin(),
+                        words_buffer_.begin() + word_begin);
+    words_buffer_.shrink_to_fit();
+    UseWordsBuffer();
+  }
+
+  std::vector<int> docs;
+  docs.reserve(m_end - m_begin + 1);
+  for (int m = m_begin; m <= m_end; m++) {
+    docs.push_back(docs_[m] - word_begin);
+  }
+  docs_.swap(docs);
+  M_ = m_end - m_begin;
+  INFO("Kept %d documents, %d words.", M_, word_end - word_begin);
+}
+
+void Corpus::GroupDocWords() {
+  grouped_ = true;
+  if (run_length_) {
+    // sort runs of each document, and merge runs of the same word
+    std::vector<std::pair<int, int> > runs;
+    int size = 0;
+    for (int m = 0; m < M_; m++) {
+      runs.clear();
+      for (int r = doc_runs_[m]; r < doc_runs_[m + 1]; r++) {
+        runs.push_back(std::make_pair(run_words_[r], run_counts_[r]));
+      }
+      std::sort(runs.begin(), runs.end());
+      doc_runs_[m] = size;
+      for (const auto& run : runs) {
+        if (size != doc_runs_[m] && run_words_[size - 1] == run.first) {
+          run_counts_[size - 1] += run.second;
+        } else {
+          run_words_[size] = run.first;
+          run_counts_[size] = run.second;
+          size++;
+        }
+      }
+    }
+    doc_runs_[M_] = size;
+    run_words_.resize(size);
+    run_counts_.resize(size);
+    INFO("Grouped words of %d documents into %d runs.", M_, size);
+    return;
+  }
+
+  UnmapWords();
+
+#if defined _OPENMP
+#pragma omp parallel for schedule(dynamic, 256)
+#endif
+  for (int m = 0; m < M_; m++) {
+    std::sort(words_buffer_.begin() + docs_[m],
+              words_buffer_.begin() + docs_[m + 1]);
+  }
+  INFO("Grouped words of %d documents.", M_);
+}
+
+void Corpus::RemapWords() {
+  std::vector<int> word_freq;
+  WordFrequency(&word_freq);
+
+  std::vector<int> new_ids;
+  BuildWordRemap(word_freq, &new_ids);
+  if (run_length_) {
+    for (int& v : run_words_) {
+      v = new_ids[v];
+    }
+  } else {
+    UnmapWords();
+    for (int& v : words_buffer_) {
+      v = new_ids[v];
+    }
+  }
+  INFO("Remapped %d words in descending order of frequency.", V_);
+}
+
+void Corpus::BuildWordRemap(const std::vector<int>& word_freq,
+                            std::vector<int>* new_ids) {
+  const int V = static_cast<int>(word_freq.size());
+  word_ids_.resize(V);
+  for (int v = 0; v < V; v++) {
+    word_ids_[v] = v;
+  }
+  std::stable_sort(word_ids_.begin(), word_ids_.end(), [&](int a, int b) {
+    return word_freq[a] > word_freq[b];
+  });
+
+  new_ids->resize(V);
+  for (int v = 0; v < V; v++) {
+    (*new_ids)[word_ids_[v]] = v;
+  }
+}
+
+void Corpus::WordFrequency(std::vector<int>* word_freq) const {
+  word_freq->assign(V_, 0);
+  if (run_length_) {
+    for (size_t r = 0; r < run_words_.size(); r++) {
+      (*word_freq)[run_words_[r]] += run_counts_[r];
+    }
+  } else {
+    for (int i = 0; i < N_; i++) {
+      (*word_freq)[words_[i]]++;
+    }
+  }
+}
+
+void Corpus::ClearRuns() {
+  run_length_ = false;
+  doc_runs_.clear();
+  run_words_.clear();
+  run_counts_.clear();
+}
+
+void Corpus::MakeRuns() {
+  doc_runs_.resize(M_ + 1);
+  run_words_.clear();
+  run_counts_.clear();
+  for (int m = 0; m < M_; m++) {
+    doc_runs_[m] = static_cast<int>(run_words_.size());
+    for (int i = docs_[m], end = docs_[m + 1]; i < end; i++) {
+      if (i != docs_[m] && words_[i] == run_words_.back()) {
+        run_counts_.back()++;
+      } else {
+        run_words_.push_back(words_[i]);
+        run_counts_.push_back(1);
+      }
+    }
+  }
+  doc_runs_[M_] = static_cast<int>(run_words_.size());
+
+  words_file_.Close();
+  words_buffer_.clear();
+  words_buffer_.shrink_to_fit();
+  words_ = nullptr;
+  run_length_ = true;
+  INFO("Stored %d words in %d runs.", N_, static_cast<int>(run_words_.size()));
+}
+
+bool Corpus::MakeDocsFromRuns() {
+  docs_.resize(M_ + 1);
+  long long n = 0;
+  for (int m = 0; m < M_; m++) {
+    docs_[m] = static_cast<int>(n);
+    for (int r = doc_runs_[m]; r < doc_runs_[m + 1]; r++) {
+      n += run_counts_[r];
+    }
+    if (n > std::numeric_limits<int>::max()) {
+      ERROR("Too many words %lld.", n);
+      return false;
+    }
+  }
+  docs_[M_] = static_cast<int>(n);
+  N_ = static_cast<int>(n);
+  words_ = nullptr;
+  run_length_ = true;
   return true;
 }
@@ -7,29 +7,130 @@
 #ifndef CORPUS_H_
 #define CORPUS_H_
 
+#include <functional>
 #include <string>
 #include <vector>
-
-struct Word {
-  int v;  // word id in vocabulary, starts from 0
-  int k;  // topic id assign to this word, starts from 0
-};
+#include "mapped_file.h"
 
 class Corpus {
  protected:
   std::vector<int> docs_;  // doc starting indices in "words_"
-  std::vector<Word> words_;
+  // words_[i]: id of word "i" in vocabulary, starts from 0.
+  // It is read only, and points to "words_buffer_", a mapped binary corpus
+  // or caller owned words.
+  const int* words_;
+  std::vector<int> words_buffer_;
+  MappedFile words_file_;
   int M_;  // # of docs
+  int N_;  // # of words
   int V_;  // # of vocabulary
+  // word_ids_[v]: original id of word "v" if words are remapped
+  std::vector<int> word_ids_;
+  // words of each document are sorted by "GroupDocWords"
+  bool grouped_;
+
+  // run length corpus:
+  // repeated words of a document are stored as (word id, count) runs,
+  // "words_" is null and "docs_" still indexes words.
+  bool run_length_;
+  std::vector<int> doc_runs_;  // doc starting indices in runs
+  std::vector<int> run_words_;
+  std::vector<int> run_counts_;
 
  public:
-  Corpus() : M_(0), V_(0) {}
+  Corpus()
+      : words_(nullptr),
+        M_(0),
+        N_(0),
+        V_(0),
+        grouped_(false),
+        run_length_(false) {}
   virtual ~Corpus() {}
 
-  int M() { return M_; }
-  int V() { return V_; }
+  int M() const { return M_; }
+  int N() const { return N_; }
+  int V() const { return V_; }
+  const std::vector<int>& docs() const { return docs_; }
+  const std::vector<int>& word_ids() const { return word_ids_; }
+  bool run_length() const { return run_length_; }
+  bool grouped() const { return grouped_; }
+
+  // Load a text corpus, or a binary corpus written by "SaveBinaryCorpus".
+  // "doc_with_id" is ignored for binary corpora.
+  // Word ids of a binary corpus are mapped, not copied.
+  // "run_length" stores repeated words as runs, like "id:count" in the input.
+  // "keep_empty_docs" keeps lines without words of a text corpus as
+  // empty documents, so that document "m" is line "m".
+  bool LoadCorpus(const std::string& filename, bool doc_with_id,
+                  bool run_length = false, bool keep_empty_docs = false);
+  bool LoadBinaryCorpus(const std::string& filename);
+  // Use caller owned documents, document "m" is words[docs[m], docs[m + 1])
+  // and docs[0] is 0. Word ids are in [0, V), and there is at least a word.
+  // "words" is not copied, and must outlive the corpus.
+  // "run_length" is the same as that of "LoadCorpus",
+  // words are copied into runs and "words" is not used after it returns.
+  bool SetCorpus(const int* docs, int M, const int* words, int V,
+                 bool run_length = false);
+  bool SaveBinaryCorpus(const std::string& filename) const;
+  // Call "func(words, n)" for each document of a text or binary corpus,
+  // without loading the whole corpus into memory.
+  static bool ScanCorpus(const std::string& filename, bool doc_with_id,
+                         const std::function<void(const int*, int)>& func,
+                         int* V);
+
+  // split documents into "parts" with about the same number of words,
+  // part "p" is [(*boundaries)[p], (*boundaries)[p + 1])
+  void PartitionDocs(int parts, std::vector<int>* boundaries) const;
+  // keep documents in [m_begin, m_end) only
+  void KeepDocs(int m_begin, int m_end);
+  // sort words of each document by word id,
+  // so that repeated words of a document are adjacent
+  void GroupDocWords();
+  // remap word ids in descending order of frequency,
+  // so that rows of frequent words are adjacent in memory
+  void RemapWords();
+  void WordFrequency(std::vector<int>* word_freq) const;
+
+  // Words of document "m",
+  // runs are expanded into "buffer" in a run length corpus.
+  // Words of a run are adjacent, so samplers fetch the row of a run once,
+  // and expanding costs a copy of the document.
+  const int* DocWords(int m, std::vector<int>* buffer) const {
+    if (!run_length_) {
+      return words_ + docs_[m];
+    }
+    buffer->clear();
+    for (int r = doc_runs_[m]; r < doc_runs_[m + 1]; r++) {
+      buffer->insert(buffer->end(), run_counts_[r], run_words_[r]);
+    }
+    return buffer->data();
+  }
+
+ protected:
+  // make "word_ids_" from "word_freq",
+  // and (*new_ids)[original id] is the new id
+  void BuildWordRemap(const std::vector<int>& word_freq,
+                      std::vector<int>* new_ids);
+  // copy mapped word ids to "words_buffer_" to modify them
+  void UnmapWords() {
+    if (words_buffer_.empty() && N_ > 0) {
+      words_buffer_.assign(words_, words_ + N_);
+      UseWordsBuffer();
+    }
+  }
+
+  void ClearRuns();
+  // make runs from "words_", and release "words_"
+  void MakeRuns();
+  // make "docs_" and "N_" from runs, return false if there are too many
+  bool MakeDocsFromRuns();
 
-  bool LoadCorpus(const std::string& filename, bool doc_with_id);
+  // let "words_" point to "words_buffer_"
+  void UseWordsBuffer() {
+    words_file_.Close();
+    words_ = words_buffer_.empty() ? nullptr : &words_buffer_[0];
+    N_ = static_cast<int>(words_buffer_.size());
+  }
 };
 
 #endif  // CORPUS_H_
@@ -0,0 +1,234 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// out-of-core corpus blocks
+//
+
+#ifndef CORPUS_STREAM_H_
+#define CORPUS_STREAM_H_
+
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <future>
+#include <string>
+#include <vector>
+#include "corpus.h"
+#include "x.h"
+
+// Documents, words and their topics are stored in a file in blocks.
+// A pass over blocks is double buffered:
+// while the caller uses a block, the previous block is written back and
+// the next block is read by a background task.
+//
+// block layout: int docs[M + 1], int words[N], Topic topics[N]
+template <class Topic>
+class CorpusStream {
+ public:
+  typedef Topic TopicType;
+
+ private:
+  struct Block {
+    long long offset;
+    int M;  // # of docs
+    int N;  // # of words
+  };
+
+  std::string filename_;
+  std::fstream file_;
+  std::vector<Block> blocks_;
+  int M_;
+  int V_;
+  long long N_;
+
+  bool write_;
+  int current_;  // block held by the caller, -1 if none
+  // the spare buffer, used by the background task
+  std::vector<int> spare_docs_;
+  std::vector<int> spare_words_;
+  std::vector<TopicType> spare_topics_;
+  std::future<bool> io_;
+
+ public:
+  CorpusStream() : M_(0), V_(0), N_(0), write_(false), current_(-1) {}
+
+  ~CorpusStream() {
+    Wait();
+    if (file_.is_open()) {
+      file_.close();
+      remove(filename_.c_str());
+    }
+  }
+
+  int M() const { return M_; }
+  int V() const { return V_; }
+  long long N() const { return N_; }
+  int blocks() const { return static_cast<int>(blocks_.size()); }
+
+  // Create "filename" from corpus "corpus_filename",
+  // documents are grouped into blocks of about "block_words" words.
+  // Word "v" is stored as "(*new_ids)[v]" if "new_ids" is not null.
+  // "group_words" sorts words of each document by word id.
+  bool Create(const std::string& corpus_filename, bool doc_with_id,
+              const std::string& filename, int block_words,
+              const std::vector<int>* new_ids, bool group_words) {
+    filename_ = filename;
+    file_.open(filename.c_str(), std::ios::in | std::ios::out |
+                                     std::ios::trunc | std::ios::binary);
+    if (!file_.is_open()) {
+      ERROR("Failed to open \"%s\".", filename.c_str());
+      return false;
+    }
+
+    INFO("Creating stream corpus \"%s\".", filename.c_str());
+    M_ = 0;
+    N_ = 0;
+    blocks_.clear();
+    std::vector<int> docs(1, 0);
+    std::vector<int> words;
+    bool ok = true;
+    auto func = [&](const int* doc, int N) {
+      words.insert(words.end(), doc, doc + N);
+      if (new_ids) {
+        for (auto it = words.end() - N; it != words.end(); ++it) {
+          *it = (*new_ids)[*it];
+        }
+      }
+      if (group_words) {
+        std::sort(words.end() - N, words.end());
+      }
+      docs.push_back(static_cast<int>(words.size()));
+      if (static_cast<int>(words.size()) >= block_words) {
+        ok = ok && AppendBlock(docs, words);
+        docs.resize(1);
+        words.clear();
+      }
+    };
+    if (!Corpus::ScanCorpus(corpus_filename, doc_with_id, func, &V_)) {
+      return false;
+    }
+    if (docs.size() > 1) {
+      ok = ok && AppendBlock(docs, words);
+    }
+    if (!ok) {
+      return false;
+    }
+
+    if (M_ == 0) {
+      ERROR("Loaded an empty corpus.");
+      return false;
+    }
+    if (V_ == 0) {
+      ERROR("Loaded an empty vocabulary.");
+      return false;
+    }
+    INFO("Created %d blocks of %d documents, %lld words, %d unique words.",
+         blocks(), M_, N_, V_);
+    return true;
+  }
+
+  void Begin(bool write) {
+    CHECK(Wait());
+    write_ = write;
+    current_ = -1;
+    io_ = std::async(std::launch::async, [this]() {
+      return ReadBlock(0, &spare_docs_, &spare_words_, &spare_topics_);
+    });
+  }
+
+  // Swap the next block into "docs", "words" and "topics",
+  // return false after the last block.
+  bool Next(std::vector<int>* docs, std::vector<int>* words,
+            std::vector<TopicType>* topics) {
+    // the spare buffer holds block "current_ + 1" after waiting
+    CHECK(Wait());
+    const int finished = current_;
+    current_++;
+    docs->swap(spare_docs_);
+    words->swap(spare_words_);
+    topics->swap(spare_topics_);
+
+    const bool write = write_ && finished != -1;
+    const int read = current_ + 1 < blocks() ? current_ + 1 : -1;
+    if (write || read != -1) {
+      io_ = std::async(std::launch::async, [this, write, finished, read]() {
+        return (!write || WriteBlock(finished, spare_topics_)) &&
+               (read == -1 ||
+                ReadBlock(read, &spare_docs_, &spare_words_, &spare_topics_));
+      });
+    }
+
+    if (current_ == blocks()) {
+      CHECK(Wait());
+      docs->clear();
+      words->clear();
+      topics->clear();
+      return false;
+    }
+    return true;
+  }
+
+ private:
+  bool Wait() {
+    if (io_.valid()) {
+      return io_.get();
+    }
+    return true;
+  }
+
+  bool ReadBlock(int b, std::vector<int>* docs, std::vector<int>* words,
+                 std::vector<TopicType>* topics) {
+    const Block& block = blocks_[b];
+    docs->resize(block.M + 1);
+    words->resize(block.N);
+    topics->resize(block.N);
+    file_.seekg(block.offset);
+    file_.read(reinterpret_cast<char*>(&(*docs)[0]),
+               sizeof(int) * (block.M + 1));
+    file_.read(reinterpret_cast<char*>(&(*words)[0]), sizeof(int) * block.N);
+    file_.read(reinterpret_cast<char*>(&(*topics)[0]),
+               sizeof(TopicType) * block.N);
+    if (!file_) {
+      ERROR("Failed to read block %d of \"%s\".", b, filename_.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool WriteBlock(int b, const std::vector<TopicType>& topics) {
+    const Block& block = blocks_[b];
+    file_.seekp(block.offset + sizeof(int) * (block.M + 1 + block.N));
+    file_.write(reinterpret_cast<const char*>(&topics[0]),
+                sizeof(TopicType) * block.N);
+    if (!file_) {
+      ERROR("Failed to write block %d of \"%s\".", b, filename_.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  bool AppendBlock(const std::vector<int>& docs,
+                   const std::vector<int>& words) {
+    Block block;
+    block.offset = static_cast<long long>(file_.tellp());
+    block.M = static_cast<int>(docs.size()) - 1;
+    block.N = static_cast<int>(words.size());
+    const std::vector<TopicType> topics(words.size());
+    file_.write(reinterpret_cast<const char*>(&docs[0]),
+                sizeof(int) * docs.size());
+    file_.write(reinterpret_cast<const char*>(&words[0]),
+                sizeof(int) * words.size());
+    file_.write(reinterpret_cast<const char*>(&topics[0]),
+                sizeof(TopicType) * topics.size());
+    if (!file_) {
+      ERROR("Failed to write \"%s\".", filename_.c_str());
+      return false;
+    }
+    blocks_.push_back(block);
+    M_ += block.M;
+    N_ += block.N;
+    return true;
+  }
+};
+
+#endif  // CORPUS_STREAM_H_
@@ -0,0 +1,194 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "dense_kernel.h"
+
+#if (defined __x86_64__ || defined __i386__) && defined __GNUC__
+#define DENSE_KERNEL_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+// ranges longer than this are narrowed by binary search first
+const int kLinearSearchSize = 64;
+
+double DenseCDFScalar(const double* a, const double* b, const double* c,
+                      int size, double* cdf) {
+  double sum = 0.0;
+  for (int k = 0; k < size; k++) {
+    sum += a[k] * b[k] * c[k];
+    cdf[k] = sum;
+  }
+  return sum;
+}
+
+int LinearSearchScalar(const double* cdf, int first, int last,
+                       double sample) {
+  for (; first < last; first++) {
+    if (cdf[first] >= sample) {
+      return first;
+    }
+  }
+  return last;
+}
+
+// Narrow [first, last) to at most "kLinearSearchSize" elements,
+// which contain the answer if it is in [first, last).
+void NarrowCDF(const double* cdf, int* first, int* last, double sample) {
+  int count = *last - *first;
+  while (count > kLinearSearchSize) {
+    const int half_count = count >> 1;
+    const int middle = *first + half_count;
+    if (sample <= cdf[middle]) {
+      count = half_count + 1;
+    } else {
+      *first = middle + 1;
+      count -= half_count + 1;
+    }
+  }
+  *last = *first + count;
+}
+
+int SearchCDFScalar(const double* cdf, int size, double sample) {
+  int first = 0, last = size;
+  NarrowCDF(cdf, &first, &last, sample);
+  const int k = LinearSearchScalar(cdf, first, last, sample);
+  return k < size ? k : size - 1;
+}
+
+#if defined DENSE_KERNEL_X86
+__attribute__((target("avx2"))) double DenseCDFAVX2(const double* a,
+                                                     const double* b,
+                                                     const double* c,
+                                                     int size, double* cdf) {
+  const __m256d zero = _mm256_setzero_pd();
+  __m256d carry = zero;
+  int k = 0;
+  for (; k + 4 <= size; k += 4) {
+    __m256d x = _mm256_mul_pd(
+        _mm256_mul_pd(_mm256_loadu_pd(a + k), _mm256_loadu_pd(b + k)),
+        _mm256_loadu_pd(c + k));
+    // in register prefix sum: shift by 1 and 2 lanes and add
+    __m256d t = _mm256_permute4x64_pd(x, _MM_SHUFFLE(2, 1, 0, 0));
+    x = _mm256_add_pd(x, _mm256_blend_pd(t, zero, 0x1));
+    t = _mm256_permute4x64_pd(x, _MM_SHUFFLE(1, 0, 0, 0));
+    x = _mm256_add_pd(x, _mm256_blend_pd(t, zero, 0x3));
+    x = _mm256_add_pd(x, carry);
+    _mm256_storeu_pd(cdf + k, x);
+    carry = _mm256_permute4x64_pd(x, _MM_SHUFFLE(3, 3, 3, 3));
+  }
+  double sum = _mm256_cvtsd_f64(carry);
+  for (; k < size; k++) {
+    sum += a[k] * b[k] * c[k];
+    cdf[k] = sum;
+  }
+  return sum;
+}
+
+__attribute__((target("avx2"))) int SearchCDFAVX2(const double* cdf,
+                                                  int size, double sample) {
+  int first = 0, last = size;
+  NarrowCDF(cdf, &first, &last, sample);
+  const __m256d s = _mm256_set1_pd(sample);
+  for (; first + 4 <= last; first += 4) {
+    const int mask = _mm256_movemask_pd(
+        _mm256_cmp_pd(_mm256_loadu_pd(cdf + first), s, _CMP_GE_OQ));
+    if (mask) {
+      return first + __builtin_ctz(mask);
+    }
+  }
+  const int k = LinearSearchScalar(cdf, first, last, sample);
+  return k < size ? k : size - 1;
+}
+
+__attribute__((target("avx512f"))) double DenseCDFAVX512(const double* a,
+                                                         const double* b,
+                                                         const double* c,
+                                                         int size,
+                                                         double* cdf) {
+  const __m512i shift1 = _mm512_set_epi64(6, 5, 4, 3, 2, 1, 0, 0);
+  const __m512i shift2 = _mm512_set_epi64(5, 4, 3, 2, 1, 0, 0, 0);
+  const __m512i shift4 = _mm512_set_epi64(3, 2, 1, 0, 0, 0, 0, 0);
+  const __m512i last_lane = _mm512_set1_epi64(7);
+  __m512d carry = _mm512_setzero_pd();
+  int k = 0;
+  for (; k + 8 <= size; k += 8) {
+    __m512d x = _mm512_mul_pd(
+        _mm512_mul_pd(_mm512_loadu_pd(a + k), _mm512_loadu_pd(b + k)),
+        _mm512_loadu_pd(c + k));
+    // in register prefix sum: shift by 1, 2 and 4 lanes and add
+    x = _mm512_add_pd(x, _mm512_maskz_permutexvar_pd(0xfe, shift1, x));
+    x = _mm512_add_pd(x, _mm512_maskz_permutexvar_pd(0xfc, shift2, x));
+    x = _mm512_add_pd(x, _mm512_maskz_permutexvar_pd(0xf0, shift4, x));
+    x = _mm512_add_pd(x, carry);
+    _mm512_storeu_pd(cdf + k, x);
+    carry = _mm512_maskz_permutexvar_pd(0xff, last_lane, x);
+  }
+  double sum = _mm512_cvtsd_f64(carry);
+  for (; k < size; k++) {
+    sum += a[k] * b[k] * c[k];
+    cdf[k] = sum;
+  }
+  return sum;
+}
+
+__attribute__((target("avx512f"))) int SearchCDFAVX512(const double* cdf,
+                                                       int size,
+                                                       double sample) {
+  int first = 0, last = size;
+  NarrowCDF(cdf, &first, &last, sample);
+  const __m512d s = _mm512_set1_pd(sample);
+  for (; first + 8 <= last; first += 8) {
+    const int mask = static_cast<int>(
+        _mm512_cmp_pd_mask(_mm512_loadu_pd(cdf + first), s, _CMP_GE_OQ));
+    if (mask) {
+      return first + __builtin_ctz(mask);
+    }
+  }
+  const int k = LinearSearchScalar(cdf, first, last, sample);
+  return k < size ? k : size - 1;
+}
+#endif
+
+struct DenseKernel {
+  double (*dense_cdf)(const double*, const double*, const double*, int,
+                      double*);
+  int (*search_cdf)(const double*, int, double);
+  const char* isa;
+
+  DenseKernel()
+      : dense_cdf(DenseCDFScalar), search_cdf(SearchCDFScalar), isa("scalar") {
+#if defined DENSE_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+      dense_cdf = DenseCDFAVX512;
+      search_cdf = SearchCDFAVX512;
+      isa = "avx512";
+    } else if (__builtin_cpu_supports("avx2")) {
+      dense_cdf = DenseCDFAVX2;
+      search_cdf = SearchCDFAVX2;
+      isa = "avx2";
+    }
+#endif
+  }
+};
+
+const DenseKernel& GetDenseKernel() {
+  static const DenseKernel kernel;
+  return kernel;
+}
+
+}  // namespace
+
+double DenseCDF(const double* a, const double* b, const double* c, int size,
+                double* cdf) {
+  return GetDenseKernel().dense_cdf(a, b, c, size, cdf);
+}
+
+int SearchCDF(const double* cdf, int size, double sample) {
+  return GetDenseKernel().search_cdf(cdf, size, sample);
+}
+
+const char* DenseKernelISA() { return GetDenseKernel().isa; }
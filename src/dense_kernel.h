@@ -0,0 +1,25 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// vectorized dense kernels of Gibbs sampling
+//
+
+#ifndef DENSE_KERNEL_H_
+#define DENSE_KERNEL_H_
+
+// Kernels use AVX-512 or AVX2 if the CPU supports them,
+// which is detected at runtime, or else scalar code.
+
+// Write inclusive prefix sums of "a[k] * b[k] * c[k]" to "cdf[0, size)",
+// and return the total.
+double DenseCDF(const double* a, const double* b, const double* c, int size,
+                double* cdf);
+
+// Return the first "k" with "cdf[k] >= sample",
+// or "size - 1" if there is none because of rounding errors.
+int SearchCDF(const double* cdf, int size, double sample);
+
+// Return the name of the instruction set used by kernels.
+const char* DenseKernelISA();
+
+#endif  // DENSE_KERNEL_H_
@@ -0,0 +1,351 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "file_reader.h"
+#include <string.h>
+#include "x.h"
+
+#if defined LDA_WITH_ZLIB
+#include <zlib.h>
+#endif
+#if defined LDA_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+const unsigned char kGzipMagic[2] = {0x1f, 0x8b};
+const unsigned char kZstdMagic[4] = {0x28, 0xb5, 0x2f, 0xfd};
+const size_t kInputSize = 1 << 20;
+
+}  // namespace
+
+FileReader::FileReader()
+    : file_(nullptr),
+      format_(kPlain),
+      stream_(nullptr),
+      in_begin_(0),
+      in_end_(0),
+      frame_end_(true),
+      head_(0),
+      filled_(0),
+      held_(false),
+      eof_(false),
+      error_(false),
+      stop_(false) {}
+
+bool FileReader::GetFormat(const std::string& filename, Format* format) {
+  FILE* file = fopen(filename.c_str(), "rb");
+  if (file == nullptr) {
+    ERROR("Failed to open \"%s\".", filename.c_str());
+    return false;
+  }
+
+  unsigned char magic[4];
+  const size_t size = fread(magic, 1, sizeof(magic), file);
+  fclose(file);
+  if (size >= sizeof(kGzipMagic) &&
+      memcmp(magic, kGzipMagic, sizeof(kGzipMagic)) == 0) {
+    *format = kGzip;
+  } else if (size >= sizeof(kZstdMagic) &&
+             memcmp(magic, kZstdMagic, sizeof(kZstdMagic)) == 0) {
+    *format = kZstd;
+  } else {
+    *format = kPlain;
+  }
+  return true;
+}
+
+bool FileReader::Open(const std::string& filename) {
+  Close();
+  if (!GetFormat(filename, &format_)) {
+    return false;
+  }
+
+  filename_ = filename;
+  file_ = fopen(filename.c_str(), "rb");
+  if (file_ == nullptr) {
+    ERROR("Failed to open \"%s\".", filename.c_str());
+    return false;
+  }
+
+  switch (format_) {
+    case kPlain:
+      break;
+    case kGzip: {
+#if defined LDA_WITH_ZLIB
+      z_stream* z = new z_stream;
+      memset(z, 0, sizeof(*z));
+      // 15 + 32: gzip or zlib header, detected automatically
+      if (inflateInit2(z, 15 + 32) != Z_OK) {
+        ERROR("Failed to initialize zlib.");
+        delete z;
+        Close();
+        return false;
+      }
+      stream_ = z;
+      break;
+#else
+      ERROR("\"%s\" is gzip compressed, but zlib is not enabled.",
+            filename.c_str());
+      Close();
+      return false;
+#endif
+    }
+    case kZstd: {
+#if defined LDA_WITH_ZSTD
+      ZSTD_DStream* z = ZSTD_createDStream();
+      if (z == nullptr || ZSTD_isError(ZSTD_initDStream(z))) {
+        ERROR("Failed to initialize zstd.");
+        ZSTD_freeDStream(z);
+        Close();
+        return false;
+      }
+      stream_ = z;
+      break;
+#else
+      ERROR("\"%s\" is zstd compressed, but zstd is not enabled.",
+            filename.c_str());
+      Close();
+      return false;
+#endif
+    }
+  }
+
+  if (format_ != kPlain) {
+    in_.resize(kInputSize);
+  }
+  for (int i = 0; i < kBuffers; i++) {
+    buffers_[i].resize(kBufferSize);
+  }
+  producer_ = std::thread([this]() { Produce(); });
+  return true;
+}
+
+void FileReader::Close() {
+  if (producer_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    producer_.join();
+  }
+  CloseStream();
+  if (file_) {
+    fclose(file_);
+    file_ = nullptr;
+  }
+  in_.clear();
+  in_begin_ = in_end_ = 0;
+  frame_end_ = true;
+  for (int i = 0; i < kBuffers; i++) {
+    buffers_[i].clear();
+    buffers_[i].shrink_to_fit();
+  }
+  head_ = 0;
+  filled_ = 0;
+  held_ = false;
+  eof_ = false;
+  error_ = false;
+  stop_ = false;
+}
+
+void FileReader::CloseStream() {
+  if (stream_ == nullptr) {
+    return;
+  }
+#if defined LDA_WITH_ZLIB
+  if (format_ == kGzip) {
+    z_stream* z = static_cast<z_stream*>(stream_);
+    inflateEnd(z);
+    delete z;
+  }
+#endif
+#if defined LDA_WITH_ZSTD
+  if (format_ == kZstd) {
+    ZSTD_freeDStream(static_cast<ZSTD_DStream*>(stream_));
+  }
+#endif
+  stream_ = nullptr;
+}
+
+bool FileReader::Next(const char** data, size_t* size) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (held_) {
+    // give back the last buffer
+    held_ = false;
+    head_ = (head_ + 1) % kBuffers;
+    filled_--;
+    cond_.notify_all();
+  }
+
+  cond_.wait(lock, [this]() { return filled_ > 0 || eof_ || error_; });
+  if (filled_ == 0 || error_) {
+    return false;
+  }
+  held_ = true;
+  *data = &buffers_[head_][0];
+  *size = sizes_[head_];
+  return true;
+}
+
+void FileReader::Produce() {
+  for (;;) {
+    int index;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return filled_ < kBuffers || stop_; });
+      if (stop_) {
+        return;
+      }
+      index = (head_ + filled_) % kBuffers;
+    }
+
+    // the consumer never touches unfilled buffers
+    const long long size = Fill(&buffers_[index][0], kBufferSize);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (size < 0) {
+        error_ = true;
+      } else if (size == 0) {
+        eof_ = true;
+      } else {
+        sizes_[index] = static_cast<size_t>(size);
+        filled_++;
+      }
+    }
+    cond_.notify_all();
+    if (size <= 0) {
+      return;
+    }
+  }
+}
+
+long long FileReader::Fill(char* buffer, size_t capacity) {
+  switch (format_) {
+    case kGzip:
+      return FillGzip(buffer, capacity);
+    case kZstd:
+      return FillZstd(buffer, capacity);
+    default:
+      return FillPlain(buffer, capacity);
+  }
+}
+
+long long FileReader::FillPlain(char* buffer, size_t capacity) {
+  size_t size = 0;
+  while (size < capacity) {
+    const size_t n = fread(buffer + size, 1, capacity - size, file_);
+    if (n == 0) {
+      break;
+    }
+    size += n;
+  }
+  if (ferror(file_)) {
+    ERROR("Failed to read \"%s\".", filename_.c_str());
+    return -1;
+  }
+  return static_cast<long long>(size);
+}
+
+bool FileReader::ReadInput() {
+  if (in_begin_ != in_end_) {
+    return true;
+  }
+  in_begin_ = 0;
+  in_end_ = fread(&in_[0], 1, in_.size(), file_);
+  return in_end_ != 0;
+}
+
+long long FileReader::FillGzip(char* buffer, size_t capacity) {
+#if defined LDA_WITH_ZLIB
+  z_stream* z = static_cast<z_stream*>(stream_);
+  size_t size = 0;
+  while (size < capacity) {
+    if (!ReadInput()) {
+      if (ferror(file_)) {
+        ERROR("Failed to read \"%s\".", filename_.c_str());
+        return -1;
+      }
+      if (!frame_end_) {
+        ERROR("\"%s\" is truncated.", filename_.c_str());
+        return -1;
+      }
+      break;
+    }
+
+    if (frame_end_) {
+      // like gzip, ignore zero padding after the last member
+      while (in_begin_ != in_end_ && in_[in_begin_] == 0) {
+        in_begin_++;
+      }
+      if (in_begin_ == in_end_) {
+        continue;
+      }
+      // the next member of a multi-member gzip file
+      if (inflateReset(z) != Z_OK) {
+        ERROR("Failed to reset zlib.");
+        return -1;
+      }
+      frame_end_ = false;
+    }
+
+    z->next_in = reinterpret_cast<Bytef*>(&in_[in_begin_]);
+    z->avail_in = static_cast<uInt>(in_end_ - in_begin_);
+    z->next_out = reinterpret_cast<Bytef*>(buffer + size);
+    z->avail_out = static_cast<uInt>(capacity - size);
+    const int ret = inflate(z, Z_NO_FLUSH);
+    in_begin_ = in_end_ - z->avail_in;
+    size = capacity - z->avail_out;
+    if (ret == Z_STREAM_END) {
+      frame_end_ = true;
+    } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+      ERROR("\"%s\" has corrupted gzip data: %s.", filename_.c_str(),
+            z->msg ? z->msg : "unknown error");
+      return -1;
+    }
+  }
+  return static_cast<long long>(size);
+#else
+  return -1;
+#endif
+}
+
+long long FileReader::FillZstd(char* buffer, size_t capacity) {
+#if defined LDA_WITH_ZSTD
+  ZSTD_DStream* z = static_cast<ZSTD_DStream*>(stream_);
+  size_t size = 0;
+  while (size < capacity) {
+    if (!ReadInput()) {
+      if (ferror(file_)) {
+        ERROR("Failed to read \"%s\".", filename_.c_str());
+        return -1;
+      }
+      if (!frame_end_) {
+        ERROR("\"%s\" is truncated.", filename_.c_str());
+        return -1;
+      }
+      break;
+    }
+
+    ZSTD_inBuffer in = {&in_[0], in_end_, in_begin_};
+    ZSTD_outBuffer out = {buffer, capacity, size};
+    // frames are concatenated in one stream
+    const size_t ret = ZSTD_decompressStream(z, &out, &in);
+    if (ZSTD_isError(ret)) {
+      ERROR("\"%s\" has corrupted zstd data: %s.", filename_.c_str(),
+            ZSTD_getErrorName(ret));
+      return -1;
+    }
+    in_begin_ = in.pos;
+    size = out.pos;
+    frame_end_ = (ret == 0);
+  }
+  return static_cast<long long>(size);
+#else
+  return -1;
+#endif
+}
@@ -0,0 +1,81 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// sequential reader of plain, gzip and zstd compressed files
+//
+
+#ifndef FILE_READER_H_
+#define FILE_READER_H_
+
+#include <stddef.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Reading and decompression run on a producer thread,
+// which fills a ring of buffers ahead of the consumer.
+// gzip needs LDA_WITH_ZLIB, zstd needs LDA_WITH_ZSTD.
+class FileReader {
+ public:
+  enum Format { kPlain, kGzip, kZstd };
+
+ private:
+  static const int kBuffers = 4;
+  static const size_t kBufferSize = 16 << 20;
+
+  std::string filename_;
+  FILE* file_;
+  Format format_;
+  void* stream_;           // decompression stream
+  std::vector<char> in_;   // compressed input
+  size_t in_begin_;        // unconsumed input is [in_begin_, in_end_)
+  size_t in_end_;
+  bool frame_end_;         // the last compressed frame is complete
+
+  std::thread producer_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::vector<char> buffers_[kBuffers];
+  size_t sizes_[kBuffers];
+  int head_;    // the buffer to be consumed next
+  int filled_;  // # of filled buffers from "head_"
+  bool held_;   // whether the consumer holds buffer "head_"
+  bool eof_;
+  bool error_;
+  bool stop_;
+
+ public:
+  FileReader();
+  ~FileReader() { Close(); }
+  FileReader(const FileReader&) = delete;
+  FileReader& operator=(const FileReader&) = delete;
+
+  // Return the format of "filename" by its magic number.
+  static bool GetFormat(const std::string& filename, Format* format);
+
+  bool Open(const std::string& filename);
+  void Close();
+  // Get the next chunk of data, which stays valid until the next call.
+  // Return false at the end or on errors.
+  bool Next(const char** data, size_t* size);
+  // Return whether errors occurred.
+  bool error() const { return error_; }
+
+ private:
+  void Produce();
+  // Fill "buffer" with up to "capacity" bytes,
+  // return # of bytes, 0 at the end, or -1 on errors.
+  long long Fill(char* buffer, size_t capacity);
+  long long FillPlain(char* buffer, size_t capacity);
+  long long FillGzip(char* buffer, size_t capacity);
+  long long FillZstd(char* buffer, size_t capacity);
+  // read more compressed input if it is used up,
+  // return false at the end or on errors
+  bool ReadInput();
+  void CloseStream();
+};
+
+#endif  // FILE_READER_H_
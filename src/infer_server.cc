@@ -0,0 +1,431 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "infer_server.h"
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#include "x.h"
+
+#if defined _WIN32
+#define INFER_SERVER_UNSUPPORTED
+#else
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#if !defined MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+#endif
+
+namespace {
+
+// nearest rank percentile, "values" are reordered
+double Percentile(std::vector<double>* values, int percent) {
+  const size_t n = values->size();
+  const size_t rank = (n * percent + 99) / 100;
+  const size_t i = rank ? rank - 1 : 0;
+  std::nth_element(values->begin(), values->begin() + i, values->end());
+  return (*values)[i];
+}
+
+}  // namespace
+
+InferServer::InferServer(const Inferer* inferer)
+    : inferer_(inferer),
+      workers_(1),
+      max_batch_(32),
+      batch_wait_us_(200),
+      report_interval_(60),
+      max_request_size_(1 << 20),
+      listen_fd_(-1),
+      stop_(false),
+      idle_workers_(0),
+      connections_(0),
+      quit_(false),
+      batches_served_(0) {}
+
+bool InferServer::ParseRequest(const char* begin, const char* end,
+                               std::vector<int>* words) {
+  words->clear();
+  const char* p = begin;
+  while (p != end) {
+    if (*p == ' ' || *p == '\t' || *p == '\r') {
+      p++;
+      continue;
+    }
+    if (*p < '0' || *p > '9') {
+      return false;
+    }
+    long long v = 0;
+    while (p != end && *p >= '0' && *p <= '9') {
+      v = v * 10 + (*p - '0');
+      if (v > INT_MAX) {
+        return false;
+      }
+      p++;
+    }
+    words->push_back(static_cast<int>(v));
+  }
+  return true;
+}
+
+void InferServer::Submit(Request* request) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  request->done = false;
+  requests_.push_back(request);
+  const int size = static_cast<int>(requests_.size());
+  if (size == 1 || size >= max_batch_) {
+    request_cond_.notify_one();
+  }
+  request->done_cond.wait(lock, [request]() { return request->done; });
+}
+
+void InferServer::Dispatch() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    request_cond_.wait(lock, [this]() {
+      return quit_ ||
+             (!requests_.empty() &&
+              static_cast<int>(batches_.size()) < idle_workers_);
+    });
+    if (quit_) {
+      break;
+    }
+
+    if (static_cast<int>(requests_.size()) < max_batch_ &&
+        batch_wait_us_ > 0) {
+      const Clock::time_point deadline =
+          requests_.front()->begin + std::chrono::microseconds(batch_wait_us_);
+      request_cond_.wait_until(lock, deadline, [this]() {
+        return quit_ || static_cast<int>(requests_.size()) >= max_batch_;
+      });
+    }
+
+    const int size =
+        std::min(static_cast<int>(requests_.size()), max_batch_);
+    batches_.emplace_back(requests_.begin(), requests_.begin() + size);
+    requests_.erase(requests_.begin(), requests_.begin() + size);
+    batch_cond_.notify_one();
+  }
+}
+
+void InferServer::Work() {
+  Inferer::Context context;
+  std::vector<double> theta(inferer_->K());
+  std::unique_lock<std::mutex> lock(mutex_);
+  for (;;) {
+    idle_workers_++;
+    request_cond_.notify_one();
+    batch_cond_.wait(lock, [this]() { return quit_ || !batches_.empty(); });
+    idle_workers_--;
+    if (batches_.empty()) {
+      break;
+    }
+
+    Batch batch = std::move(batches_.front());
+    batches_.pop_front();
+    lock.unlock();
+    for (Request* request : batch) {
+      Infer(&context, &theta, request);
+    }
+    AddStats(batch);
+    lock.lock();
+    for (Request* request : batch) {
+      request->done = true;
+      request->done_cond.notify_one();
+    }
+  }
+}
+
+void InferServer::Infer(Inferer::Context* context, std::vector<double>* theta,
+                        Request* request) const {
+  const std::vector<int>& words = request->words;
+  inferer_->InferDocument(words.data(), static_cast<int>(words.size()),
+                          context);
+  inferer_->GetDocTopicDistribution(context->topics.data(),
+                                    static_cast<int>(context->topics.size()),
+                                    &(*theta)[0]);
+
+  std::string& reply = request->reply;
+  char buffer[32];
+  reply.clear();
+  for (size_t k = 0; k < theta->size(); k++) {
+    if (k) {
+      reply.push_back(' ');
+    }
+    snprintf(buffer, sizeof(buffer), "%g", (*theta)[k]);
+    reply += buffer;
+  }
+  reply.push_back('\n');
+}
+
+void InferServer::AddStats(const Batch& batch) {
+  const Clock::time_point now = Clock::now();
+  std::lock_guard<std::mutex> guard(stats_mutex_);
+  for (const Request* request : batch) {
+    latencies_.push_back(
+        std::chrono::duration<double, std::milli>(now - request->begin)
+            .count());
+  }
+  batches_served_++;
+}
+
+void InferServer::Report() {
+  std::vector<double> latencies;
+  long long batches;
+  double seconds;
+  {
+    const Clock::time_point now = Clock::now();
+    std::lock_guard<std::mutex> guard(stats_mutex_);
+    latencies.swap(latencies_);
+    batches = batches_served_;
+    batches_served_ = 0;
+    seconds = std::chrono::duration<double>(now - report_begin_).count();
+    report_begin_ = now;
+  }
+
+  if (latencies.empty()) {
+    return;
+  }
+  const int requests = static_cast<int>(latencies.size());
+  const double p50 = Percentile(&latencies, 50);
+  const double p99 = Percentile(&latencies, 99);
+  INFO(
+      "Served %d requests in %lld batches, %lg requests/s, "
+      "latency p50 %lg ms, p99 %lg ms.",
+      requests, batches, seconds > 0.0 ? requests / seconds : 0.0, p50, p99);
+}
+
+#if defined INFER_SERVER_UNSUPPORTED
+InferServer::~InferServer() {}
+
+bool InferServer::Listen(const std::string& path) {
+  ERROR("Unix domain sockets are not supported on this platform.");
+  return false;
+}
+
+void InferServer::Run() {}
+
+void InferServer::Accept() {}
+
+void InferServer::ServeConnection(int fd) {}
+#else
+InferServer::~InferServer() {
+  if (listen_fd_ != -1) {
+    close(listen_fd_);
+    unlink(path_.c_str());
+  }
+}
+
+bool InferServer::Listen(const std::string& path) {
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path)) {
+    ERROR("Bad socket path \"%s\".", path.c_str());
+    return false;
+  }
+  memcpy(addr.sun_path, path.c_str(), path.size());
+
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1) {
+    ERROR("Failed to create a socket.");
+    return false;
+  }
+
+  struct stat st;
+  if (stat(path.c_str(), &st) == 0) {
+    if (!S_ISSOCK(st.st_mode)) {
+      ERROR("\"%s\" exists and is not a socket.", path.c_str());
+      close(fd);
+      return false;
+    }
+    // a stale socket file is left by a killed server
+    const int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    const bool in_use =
+        probe != -1 && connect(probe, reinterpret_cast<const sockaddr*>(&addr),
+                               sizeof(addr)) == 0;
+    if (probe != -1) {
+      close(probe);
+    }
+    if (in_use) {
+      ERROR("\"%s\" is in use.", path.c_str());
+      close(fd);
+      return false;
+    }
+    unlink(path.c_str());
+  }
+
+  if (bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) ==
+      -1) {
+    ERROR("Failed to bind \"%s\".", path.c_str());
+    close(fd);
+    return false;
+  }
+  if (listen(fd, SOMAXCONN) == -1) {
+    ERROR("Failed to listen on \"%s\".", path.c_str());
+    close(fd);
+    unlink(path.c_str());
+    return false;
+  }
+
+  path_ = path;
+  listen_fd_ = fd;
+  return true;
+}
+
+void InferServer::Run() {
+  INFO("Serving on \"%s\" with %d workers.", path_.c_str(), workers_);
+  report_begin_ = Clock::now();
+  std::thread dispatcher(&InferServer::Dispatch, this);
+  std::vector<std::thread> workers;
+  for (int i = 0; i < workers_; i++) {
+    workers.emplace_back(&InferServer::Work, this);
+  }
+
+  Accept();
+
+  INFO("Server is stopping.");
+  close(listen_fd_);
+  listen_fd_ = -1;
+  unlink(path_.c_str());
+  {
+    // in flight requests are finished before workers quit
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (int fd : connection_fds_) {
+      shutdown(fd, SHUT_RDWR);
+    }
+    connection_cond_.wait(lock, [this]() { return connections_ == 0; });
+    quit_ = true;
+  }
+  request_cond_.notify_all();
+  batch_cond_.notify_all();
+  dispatcher.join();
+  for (std::thread& worker : workers) {
+    worker.join();
+  }
+  Report();
+  INFO("Server is stopped.");
+}
+
+void InferServer::Accept() {
+  while (!stop_) {
+    pollfd pfd;
+    pfd.fd = listen_fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    const int ret = poll(&pfd, 1, 100);
+    if (report_interval_ > 0) {
+      bool report;
+      {
+        std::lock_guard<std::mutex> guard(stats_mutex_);
+        report = Clock::now() - report_begin_ >=
+                 std::chrono::seconds(report_interval_);
+      }
+      if (report) {
+        Report();
+      }
+    }
+    if (ret <= 0) {
+      continue;
+    }
+
+    const int fd = accept(listen_fd_, nullptr, nullptr);
+    if (fd == -1) {
+      continue;
+    }
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      connection_fds_.insert(fd);
+      connections_++;
+    }
+    std::thread(&InferServer::ServeConnection, this, fd).detach();
+  }
+}
+
+void InferServer::ServeConnection(int fd) {
+  auto send_all = [fd](const std::string& data) {
+    const char* p = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+      const ssize_t size = send(fd, p, left, MSG_NOSIGNAL);
+      if (size == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      p += size;
+      left -= static_cast<size_t>(size);
+    }
+    return true;
+  };
+
+  const size_t max_request_size = static_cast<size_t>(max_request_size_);
+  Request request;
+  std::string buffer;
+  size_t begin = 0;
+  // the rest of a request longer than "max_request_size" is discarded
+  bool discarding = false;
+  char chunk[4096];
+  for (;;) {
+    const size_t eol = buffer.find('\n', begin);
+    if (eol == std::string::npos) {
+      buffer.erase(0, begin);
+      begin = 0;
+      if (buffer.size() > max_request_size) {
+        buffer.clear();
+        if (!discarding) {
+          discarding = true;
+          if (!send_all("ERROR request too long\n")) {
+            break;
+          }
+        }
+      }
+      const ssize_t size = recv(fd, chunk, sizeof(chunk), 0);
+      if (size == -1 && errno == EINTR) {
+        continue;
+      }
+      if (size <= 0) {
+        break;
+      }
+      buffer.append(chunk, static_cast<size_t>(size));
+      continue;
+    }
+
+    if (discarding) {
+      discarding = false;
+      begin = eol + 1;
+      continue;
+    }
+
+    request.begin = Clock::now();
+    if (eol - begin > max_request_size) {
+      request.reply = "ERROR request too long\n";
+    } else if (ParseRequest(buffer.data() + begin, buffer.data() + eol,
+                            &request.words)) {
+      Submit(&request);
+    } else {
+      request.reply = "ERROR bad word ids\n";
+    }
+    begin = eol + 1;
+
+    if (!send_all(request.reply)) {
+      break;
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  connection_fds_.erase(fd);
+  close(fd);
+  connections_--;
+  connection_cond_.notify_all();
+}
+#endif
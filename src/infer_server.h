@@ -0,0 +1,108 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// topic inference server over a Unix domain socket
+//
+
+#ifndef INFER_SERVER_H_
+#define INFER_SERVER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "inferer.h"
+
+// Protocol: a client sends a document as a line of word ids,
+// and receives a line of probabilities of all topics,
+// or a line beginning with "ERROR".
+// Each connection has one request in flight.
+// Lines longer than "max_request_size" bytes are discarded with an error.
+//
+// Connection threads read requests into a queue.
+// The dispatcher groups queued requests into micro-batches of up to
+// "max_batch" requests when a worker is idle, waiting at most
+// "batch_wait_us" for a batch to fill,
+// and workers infer batches with their own contexts.
+// Requests queue up while all workers are busy, so batches grow with load.
+class InferServer {
+ private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Request {
+    std::vector<int> words;
+    std::string reply;
+    Clock::time_point begin;
+    bool done;
+    std::condition_variable done_cond;
+  };
+  typedef std::vector<Request*> Batch;
+
+  const Inferer* inferer_;
+  int workers_;
+  int max_batch_;
+  int batch_wait_us_;
+  int report_interval_;
+  int max_request_size_;
+
+  std::string path_;
+  int listen_fd_;
+  std::atomic<bool> stop_;
+
+  std::mutex mutex_;
+  std::condition_variable request_cond_;     // for the dispatcher
+  std::condition_variable batch_cond_;       // for workers
+  std::condition_variable connection_cond_;  // a connection is closed
+  std::deque<Request*> requests_;
+  std::deque<Batch> batches_;
+  int idle_workers_;
+  std::set<int> connection_fds_;
+  int connections_;  // # of running connection threads
+  bool quit_;        // dispatcher and workers quit
+
+  // statistics since the last report
+  std::mutex stats_mutex_;
+  std::vector<double> latencies_;  // ms
+  long long batches_served_;
+  Clock::time_point report_begin_;
+
+ public:
+  explicit InferServer(const Inferer* inferer);
+  ~InferServer();
+  InferServer(const InferServer&) = delete;
+  InferServer& operator=(const InferServer&) = delete;
+
+  int& workers() { return workers_; }
+  int& max_batch() { return max_batch_; }
+  int& batch_wait_us() { return batch_wait_us_; }
+  // seconds between statistics reports, 0 disables them
+  int& report_interval() { return report_interval_; }
+  int& max_request_size() { return max_request_size_; }
+
+  // Listen on "path", replacing a stale socket file.
+  bool Listen(const std::string& path);
+  // Serve until "Stop" is called.
+  void Run();
+  // Thread and async signal safe.
+  void Stop() { stop_ = true; }
+
+ private:
+  void Accept();
+  void ServeConnection(int fd);
+  // Parse a line of word ids, return false on errors.
+  static bool ParseRequest(const char* begin, const char* end,
+                           std::vector<int>* words);
+  void Submit(Request* request);
+  void Dispatch();
+  void Work();
+  void Infer(Inferer::Context* context, std::vector<double>* theta,
+             Request* request) const;
+  void AddStats(const Batch& batch);
+  void Report();
+};
+
+#endif  // INFER_SERVER_H_
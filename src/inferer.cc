@@ -0,0 +1,367 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "inferer.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include "x.h"
+
+Inferer::Inferer()
+    : V_(0),
+      K_(0),
+      hp_beta_(0.0),
+      hp_sum_beta_(0.0),
+      hp_sum_alpha_(0.0),
+      beta_sum_(0.0),
+      words_sum_(nullptr),
+      words_alias_(nullptr),
+      mh_step_(2),
+      max_sweeps_(50),
+      stop_ratio_(0.05) {}
+
+bool Inferer::LoadModel(const std::string& filename) {
+  if (!OpenModel(filename)) {
+    return false;
+  }
+  BuildWordProposals();
+  return true;
+}
+
+bool Inferer::LoadModel(const std::string& filename,
+                        const std::string& alias_filename) {
+  if (!OpenModel(filename)) {
+    return false;
+  }
+  if (std::ifstream(alias_filename.c_str()).is_open()) {
+    if (MapWordProposals(alias_filename)) {
+      return true;
+    }
+    INFO("\"%s\" is not for this model, rebuilding it.",
+         alias_filename.c_str());
+  }
+  BuildWordProposals();
+  return SaveAliasFile(alias_filename);
+}
+
+bool Inferer::SaveAliasFile(const std::string& filename) const {
+  INFO("Saving word proposals.");
+  const std::string tmp_filename = filename + ".tmp";
+  std::ofstream ofs(tmp_filename.c_str(), std::ios::binary);
+  if (!ofs.is_open()) {
+    ERROR("Failed to open \"%s\".", tmp_filename.c_str());
+    return false;
+  }
+
+  AliasFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kAliasFileMagic, sizeof(header.magic));
+  header.version = kAliasFileVersion;
+  header.V = V_;
+  header.K = K_;
+  header.nnz = model_.nnz();
+  header.model_digest = model_.Digest();
+  header.beta_sum = beta_sum_;
+  ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  ofs.write(reinterpret_cast<const char*>(words_sum_), sizeof(double) * V_);
+  ofs.write(reinterpret_cast<const char*>(beta_alias_.table()),
+            sizeof(AliasItemD) * K_);
+  ofs.write(reinterpret_cast<const char*>(words_alias_),
+            sizeof(AliasItemF) * model_.nnz());
+  ofs.close();
+  if (!ofs) {
+    ERROR("Failed to write \"%s\".", tmp_filename.c_str());
+    remove(tmp_filename.c_str());
+    return false;
+  }
+
+  if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+    ERROR("Failed to rename \"%s\" to \"%s\".", tmp_filename.c_str(),
+          filename.c_str());
+    remove(tmp_filename.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool Inferer::OpenModel(const std::string& filename) {
+  INFO("Loading model.");
+  alias_file_.Close();
+  if (!model_.Open(filename)) {
+    return false;
+  }
+
+  V_ = model_.V();
+  K_ = model_.K();
+  hp_beta_ = model_.beta();
+  hp_sum_beta_ = V_ * hp_beta_;
+  hp_alpha_.assign(model_.alpha(), model_.alpha() + K_);
+  hp_sum_alpha_ = 0.0;
+  for (int k = 0; k < K_; k++) {
+    hp_sum_alpha_ += hp_alpha_[k];
+  }
+  std::vector<double> pdf = hp_alpha_;
+  AliasBuilder builder;
+  builder.Build(&hp_alpha_alias_, &pdf, hp_sum_alpha_);
+
+  topics_denom_.resize(K_);
+  for (int k = 0; k < K_; k++) {
+    topics_denom_[k] = 1.0 / (model_.topics_count()[k] + hp_sum_beta_);
+  }
+  return true;
+}
+
+void Inferer::BuildWordProposals() {
+  INFO("Building word proposals.");
+  std::vector<double> pdf(K_);
+  beta_sum_ = 0.0;
+  for (int k = 0; k < K_; k++) {
+    pdf[k] = hp_beta_ * topics_denom_[k];
+    beta_sum_ += pdf[k];
+  }
+  beta_alias_buffer_.resize(K_);
+  AliasBuilder builder;
+  builder.Build(&beta_alias_buffer_[0], &pdf, beta_sum_);
+  beta_alias_ = AliasViewD(beta_alias_buffer_.data(), K_);
+
+  words_sum_buffer_.assign(V_, 0.0);
+  words_alias_buffer_.resize(static_cast<size_t>(model_.nnz()));
+#if defined _OPENMP
+#pragma omp parallel
+#endif
+  {
+    AliasBuilder word_builder;
+    std::vector<double> word_pdf;
+#if defined _OPENMP
+#pragma omp for schedule(dynamic, 256)
+#endif
+    for (int v = 0; v < V_; v++) {
+      const ModelFileEntry* first = model_.row_begin(v);
+      const ModelFileEntry* last = model_.row_end(v);
+      if (first == last) {
+        continue;
+      }
+      double sum = 0.0;
+      word_pdf.clear();
+      for (; first != last; ++first) {
+        const double pdf_k = first->count * topics_denom_[first->k];
+        word_pdf.push_back(pdf_k);
+        sum += pdf_k;
+      }
+      word_builder.Build(&words_alias_buffer_[model_.row_offset(v)],
+                         &word_pdf, sum);
+      words_sum_buffer_[v] = sum;
+    }
+  }
+  words_sum_ = words_sum_buffer_.data();
+  words_alias_ = words_alias_buffer_.data();
+}
+
+bool Inferer::MapWordProposals(const std::string& alias_filename) {
+  if (!alias_file_.Open(alias_filename)) {
+    return false;
+  }
+  if (alias_file_.V() != V_ || alias_file_.K() != K_ ||
+      alias_file_.nnz() != model_.nnz() ||
+      alias_file_.model_digest() != model_.Digest()) {
+    alias_file_.Close();
+    return false;
+  }
+
+  // a corrupt file must not make samples read out of tables
+  bool good = true;
+  const AliasItemD* beta_alias = alias_file_.beta_alias();
+  for (int k = 0; k < K_; k++) {
+    good &= beta_alias[k].index >= 0 && beta_alias[k].index < K_;
+  }
+  const double* words_sum = alias_file_.words_sum();
+  const AliasItemF* words_alias = alias_file_.words_alias();
+  for (int v = 0; v < V_; v++) {
+    const int64_t begin = model_.row_offset(v);
+    const int size = static_cast<int>(model_.row_offset(v + 1) - begin);
+    good &= size > 0 || !(words_sum[v] > 0);
+    for (int i = 0; i < size; i++) {
+      const int index = words_alias[begin + i].index;
+      good &= index >= 0 && index < size;
+    }
+  }
+  if (!good) {
+    ERROR("\"%s\" has bad alias tables.", alias_filename.c_str());
+    alias_file_.Close();
+    return false;
+  }
+
+  INFO("Mapped word proposals from \"%s\".", alias_filename.c_str());
+  beta_alias_buffer_.clear();
+  beta_alias_buffer_.shrink_to_fit();
+  words_sum_buffer_.clear();
+  words_sum_buffer_.shrink_to_fit();
+  words_alias_buffer_.clear();
+  words_alias_buffer_.shrink_to_fit();
+  beta_alias_ = AliasViewD(alias_file_.beta_alias(), K_);
+  beta_sum_ = alias_file_.beta_sum();
+  words_sum_ = alias_file_.words_sum();
+  words_alias_ = alias_file_.words_alias();
+  return true;
+}
+
+int Inferer::InferDocument(const int* words, int doc_length,
+                           Context* context) const {
+  std::vector<int>& doc_words = context->words;
+  std::vector<int>& topics = context->topics;
+  std::vector<int>& doc_topics_count = context->doc_topics_count;
+  Random* random = &context->random;
+
+  // clear counts of the last document
+  doc_topics_count.resize(K_);
+  for (int k : topics) {
+    doc_topics_count[k] = 0;
+  }
+
+  doc_words.clear();
+  for (int n = 0; n < doc_length; n++) {
+    if (words[n] >= 0 && words[n] < V_) {
+      doc_words.push_back(words[n]);
+    }
+  }
+  const int L = static_cast<int>(doc_words.size());
+
+  // initialize topics from word proposals
+  topics.resize(L);
+  for (int n = 0; n < L; n++) {
+    const int k = SampleWithWord(doc_words[n], random);
+    topics[n] = k;
+    ++doc_topics_count[k];
+  }
+  if (L == 0) {
+    return 0;
+  }
+
+  int s, t;
+  int N_ms, N_mt, N_ms_prime, N_mt_prime;
+  double phi_s, phi_t, hp_alpha_s, hp_alpha_t;
+  double accept_rate;
+  int sweep = 0;
+  while (sweep < max_sweeps_) {
+    sweep++;
+    int changed = 0;
+    for (int n = 0; n < L; n++) {
+      const int v = doc_words[n];
+      const int old_k = topics[n];
+      s = old_k;
+      N_ms = doc_topics_count[s];
+      N_ms_prime = N_ms - 1;
+      hp_alpha_s = hp_alpha_[s];
+      phi_s = Phi(v, s);
+
+      for (int step = 0; step < mh_step_; step++) {
+        // word proposal: (N_vk + beta)/(N_k + sum_beta),
+        // the same as the word part of the posterior
+        t = SampleWithWord(v, random);
+        if (s != t) {
+          // (N^{'}_{mt} + \alpha_t) / (N^{'}_{ms} + \alpha_s)
+          N_mt = doc_topics_count[t];
+          N_mt_prime = (old_k == t) ? N_mt - 1 : N_mt;
+          hp_alpha_t = hp_alpha_[t];
+          accept_rate = (N_mt_prime + hp_alpha_t) / (N_ms_prime + hp_alpha_s);
+          if (random->GetNext() < accept_rate) {
+            topics[n] = t;
+            s = t;
+            N_ms = N_mt;
+            N_ms_prime = N_mt_prime;
+            hp_alpha_s = hp_alpha_t;
+            phi_s = Phi(v, s);
+          }
+        }
+
+        // doc proposal: N_mk + alpha_k
+        t = SampleWithDoc(topics, random);
+        if (s != t) {
+          // (N^{'}_{mt} + \alpha_t)(N_vt + \beta)(N_s + \sum\beta)
+          // ------------------------------------------------------
+          // (N^{'}_{ms} + \alpha_s)(N_vs + \beta)(N_t + \sum\beta)
+          // *
+          // (N_{ms} + \alpha_s)
+          // -------------------
+          // (N_{mt} + \alpha_t)
+          N_mt = doc_topics_count[t];
+          N_mt_prime = (old_k == t) ? N_mt - 1 : N_mt;
+          hp_alpha_t = hp_alpha_[t];
+          phi_t = Phi(v, t);
+          accept_rate = (N_mt_prime + hp_alpha_t) / (N_ms_prime + hp_alpha_s) *
+                        phi_t / phi_s * (N_ms + hp_alpha_s) /
+                        (N_mt + hp_alpha_t);
+          if (random->GetNext() < accept_rate) {
+            topics[n] = t;
+            s = t;
+            N_ms = N_mt;
+            N_ms_prime = N_mt_prime;
+            hp_alpha_s = hp_alpha_t;
+            phi_s = phi_t;
+          }
+        }
+      }
+
+      if (old_k != s) {
+        --doc_topics_count[old_k];
+        ++doc_topics_count[s];
+        changed++;
+      }
+    }
+
+    if (changed <= stop_ratio_ * L) {
+      break;
+    }
+  }
+  return sweep;
+}
+
+void Inferer::GetDocTopicDistribution(const int* topics, int size,
+                                      double* theta) const {
+  const double denom = 1.0 / (size + hp_sum_alpha_);
+  for (int k = 0; k < K_; k++) {
+    theta[k] = hp_alpha_[k] * denom;
+  }
+  for (int n = 0; n < size; n++) {
+    theta[topics[n]] += denom;
+  }
+}
+
+double Inferer::Phi(int v, int k) const {
+  const ModelFileEntry* first = model_.row_begin(v);
+  const ModelFileEntry* last = model_.row_end(v);
+  const ModelFileEntry* it = std::lower_bound(
+      first, last, k,
+      [](const ModelFileEntry& entry, int k) { return entry.k < k; });
+  const int count = (it != last && it->k == k) ? it->count : 0;
+  return (count + hp_beta_) * topics_denom_[k];
+}
+
+int Inferer::SampleWithWord(int v, Random* random) const {
+  const double sample = random->GetNext() * (words_sum_[v] + beta_sum_);
+  if (sample < words_sum_[v]) {
+    const int64_t begin = model_.row_offset(v);
+    const AliasViewF alias(words_alias_ + begin,
+                           static_cast<int>(model_.row_offset(v + 1) - begin));
+    const int i = alias.Sample(sample / words_sum_[v]);
+    return model_.row_begin(v)[i].k;
+  }
+  return beta_alias_.Sample(random->GetNext());
+}
+
+int Inferer::SampleWithDoc(const std::vector<int>& topics,
+                           Random* random) const {
+  const int doc_length = static_cast<int>(topics.size());
+  const double sample = random->GetNext() * (hp_sum_alpha_ + doc_length);
+  if (sample < hp_sum_alpha_) {
+    return hp_alpha_alias_.Sample(sample / hp_sum_alpha_);
+  }
+  int index = static_cast<int>(sample - hp_sum_alpha_);
+  if (index == doc_length) {
+    // rare numerical errors may lie in this branch
+    index--;
+  }
+  return topics[index];
+}
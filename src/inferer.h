@@ -0,0 +1,101 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// topic inference of unseen documents against a frozen model
+//
+
+#ifndef INFERER_H_
+#define INFERER_H_
+
+#include <string>
+#include <vector>
+#include "alias.h"
+#include "alias_file.h"
+#include "model_file.h"
+#include "rand.h"
+
+// LightLDA style MH sampling with word and doc proposals.
+// Word-topic counts are frozen, so word proposals of all words are
+// precomputed as alias tables, which are shared by all threads.
+// A word proposal of word "v" is a mixture of
+// a sparse part: N_vk / (N_k + sum_beta), an alias table per word, and
+// a dense part: beta / (N_k + sum_beta), one alias table for all words.
+// They may be saved to an alias file, which later loads map instantly.
+class Inferer {
+ public:
+  // per thread states and buffers
+  struct Context {
+    Random random;
+    std::vector<int> words;             // known words of a document
+    std::vector<int> topics;            // topics of "words"
+    std::vector<int> doc_topics_count;  // topic counts of "words"
+  };
+
+ private:
+  ModelFile model_;
+  int V_;
+  int K_;
+  double hp_beta_;
+  double hp_sum_beta_;
+  std::vector<double> hp_alpha_;
+  double hp_sum_alpha_;
+  AliasD hp_alpha_alias_;
+  // topics_denom_[k]: 1 / (N_k + sum_beta)
+  std::vector<double> topics_denom_;
+  // word proposals are built in buffers or mapped from "alias_file_"
+  AliasFile alias_file_;
+  std::vector<AliasItemD> beta_alias_buffer_;
+  std::vector<double> words_sum_buffer_;
+  std::vector<AliasItemF> words_alias_buffer_;
+  AliasViewD beta_alias_;
+  double beta_sum_;
+  const double* words_sum_;
+  // tables of all words in the same CSR form as entries of "model_"
+  const AliasItemF* words_alias_;
+
+  int mh_step_;
+  int max_sweeps_;
+  double stop_ratio_;
+
+ public:
+  Inferer();
+
+  int& mh_step() { return mh_step_; }
+  int& max_sweeps() { return max_sweeps_; }
+  double& stop_ratio() { return stop_ratio_; }
+  int V() const { return V_; }
+  int K() const { return K_; }
+
+  // Load a binary model written by "Model::SaveBinaryModel",
+  // and build word proposals.
+  bool LoadModel(const std::string& filename);
+  // Load a model like the above, but map word proposals from
+  // "alias_filename" if it was saved for this model,
+  // otherwise build and save them to it.
+  bool LoadModel(const std::string& filename,
+                 const std::string& alias_filename);
+  // Save word proposals to "filename", replacing it atomically.
+  bool SaveAliasFile(const std::string& filename) const;
+
+  // Infer topics of "words[0, doc_length)" in "context".
+  // Words not in the model are ignored.
+  // Sweeps stop after "max_sweeps" sweeps, or after a sweep where
+  // no more than "stop_ratio" of words change their topics.
+  // Return # of sweeps.
+  int InferDocument(const int* words, int doc_length, Context* context) const;
+
+  // Write the topic distribution of a document to "theta[0, K)",
+  // "topics[0, size)" are topics of its known words.
+  void GetDocTopicDistribution(const int* topics, int size,
+                               double* theta) const;
+
+ private:
+  bool OpenModel(const std::string& filename);
+  void BuildWordProposals();
+  bool MapWordProposals(const std::string& alias_filename);
+  double Phi(int v, int k) const;
+  int SampleWithWord(int v, Random* random) const;
+  int SampleWithDoc(const std::vector<int>& topics, Random* random) const;
+};
+
+#endif  // INFERER_H_
@@ -0,0 +1,85 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// LDA corpus converter main
+//
+
+#include <string>
+#include "args.h"
+#include "corpus.h"
+#include "x.h"
+
+namespace {
+
+// input options
+int doc_with_id;
+std::string input_corpus_filename;
+
+// output options
+std::string output_corpus_filename;
+
+void Usage() {
+  fprintf(stderr,
+          "Usage: lda-convert [options] INPUT_FILE OUTPUT_FILE\n"
+          "  INPUT_FILE: input text corpus filename,\n"
+          "    which may be gzip or zstd compressed.\n"
+          "  OUTPUT_FILE: output binary corpus filename,\n"
+          "    which can be used as INPUT_FILE of lda-train.\n"
+          "\n"
+          "  Options:\n"
+          "    -doc_with_id 0/1\n"
+          "      Whether the first column of INPUT_FILE is doc ID, "
+          "and skip it.\n"
+          "      Default is \"%d\".\n",
+          doc_with_id);
+  exit(1);
+}
+
+void ParseArgs(int argc, char** argv) {
+  if (argc == 1) {
+    Usage();
+  }
+
+  int i = 1;
+  for (;;) {
+    std::string s = argv[i];
+    if (s == "-h" || s == "-help" || s == "--help") {
+      Usage();
+    }
+
+    if (s.size() >= 2 && s[0] == '-' && s[1] == '-') {
+      s.erase(s.begin());
+    }
+
+    if (s == "-doc_with_id") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      doc_with_id = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else {
+      i++;
+    }
+    if (i == argc) {
+      break;
+    }
+  }
+
+  if (argc != 3) {
+    Usage();
+  }
+
+  CHECK(doc_with_id == 0 || doc_with_id == 1);
+
+  input_corpus_filename = argv[1];
+  output_corpus_filename = argv[2];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ParseArgs(argc, argv);
+
+  Corpus corpus;
+  CHECK(corpus.LoadCorpus(input_corpus_filename, doc_with_id != 0));
+  CHECK(corpus.SaveBinaryCorpus(output_corpus_filename));
+  return 0;
+}
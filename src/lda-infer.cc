@@ -0,0 +1,209 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// LDA inference main
+//
+
+#include <algorithm>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "args.h"
+#include "corpus.h"
+#include "inferer.h"
+#include "scheduler.h"
+#include "x.h"
+
+namespace {
+
+// input options
+int doc_with_id;
+std::string model_filename;
+std::string alias_filename;
+std::string input_corpus_filename;
+
+// output options
+std::string output_filename;
+
+// inference options
+int mh_step = 2;
+int max_sweeps = 50;
+double stop_ratio = 0.05;
+int threads = 1;
+
+void Usage() {
+  fprintf(stderr,
+          "Usage: lda-infer [options] MODEL_FILE INPUT_FILE OUTPUT_FILE\n"
+          "  MODEL_FILE: binary model written by lda-train,\n"
+          "    OUTPUT_PREFIX-model.bin.\n"
+          "  INPUT_FILE: input corpus filename,\n"
+          "    in the same formats as lda-train.\n"
+          "    Words not in the model are ignored.\n"
+          "  OUTPUT_FILE: output filename, the i-th line holds\n"
+          "    probabilities of all topics of the i-th document.\n"
+          "    Documents without known words get the prior.\n"
+          "\n"
+          "  Options:\n"
+          "    -alias_file ALIAS_FILE\n"
+          "      File of precomputed word proposals of MODEL_FILE.\n"
+          "      It is mapped if it matches MODEL_FILE, or else\n"
+          "      it is built and saved, so later runs start instantly\n"
+          "      and processes share it in the page cache.\n"
+          "      Default is \"%s\", building them in memory.\n"
+          "    -doc_with_id 0/1\n"
+          "      Whether the first column of INPUT_FILE is doc ID, "
+          "and skip it.\n"
+          "      Default is \"%d\".\n"
+          "    -mh_step MH_STEP\n"
+          "      Number of MH steps.\n"
+          "      Default is \"%d\".\n"
+          "    -max_sweeps SWEEPS\n"
+          "      Maximum number of sweeps over each document.\n"
+          "      Default is \"%d\".\n"
+          "    -stop_ratio RATIO\n"
+          "      Stop sampling a document after a sweep where\n"
+          "      no more than RATIO of its words change topics.\n"
+          "      Default is \"%lg\".\n"
+          "    -threads THREADS\n"
+          "      Number of inference threads.\n"
+          "      Default is \"%d\".\n",
+          alias_filename.c_str(), doc_with_id, mh_step, max_sweeps, stop_ratio,
+          threads);
+  exit(1);
+}
+
+void ParseArgs(int argc, char** argv) {
+  if (argc == 1) {
+    Usage();
+  }
+
+  int i = 1;
+  for (;;) {
+    std::string s = argv[i];
+    if (s == "-h" || s == "-help" || s == "--help") {
+      Usage();
+    }
+
+    if (s.size() >= 2 && s[0] == '-' && s[1] == '-') {
+      s.erase(s.begin());
+    }
+
+    if (s == "-alias_file") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      alias_filename = argv[i + 1];
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-doc_with_id") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      doc_with_id = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-mh_step") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      mh_step = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-max_sweeps") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      max_sweeps = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-stop_ratio") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      stop_ratio = xatod(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-threads") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      threads = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else {
+      i++;
+    }
+    if (i == argc) {
+      break;
+    }
+  }
+
+  if (argc != 4) {
+    Usage();
+  }
+
+  CHECK(doc_with_id == 0 || doc_with_id == 1);
+  CHECK(mh_step > 0);
+  CHECK(max_sweeps > 0);
+  CHECK(stop_ratio >= 0.0);
+  CHECK(threads >= 1);
+
+  model_filename = argv[1];
+  input_corpus_filename = argv[2];
+  output_filename = argv[3];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ParseArgs(argc, argv);
+
+  Inferer inferer;
+  inferer.mh_step() = mh_step;
+  inferer.max_sweeps() = max_sweeps;
+  inferer.stop_ratio() = stop_ratio;
+  if (alias_filename.empty()) {
+    CHECK(inferer.LoadModel(model_filename));
+  } else {
+    CHECK(inferer.LoadModel(model_filename, alias_filename));
+  }
+
+  Corpus corpus;
+  // output line "m" is document "m", even if it has no words
+  CHECK(corpus.LoadCorpus(input_corpus_filename, doc_with_id != 0, false,
+                          true));
+  const int M = corpus.M();
+  const int K = inferer.K();
+  const std::vector<int>& docs = corpus.docs();
+
+  // topics of known words of doc "m" are
+  // [topics[docs[m]], topics[docs[m] + known[m]])
+  std::vector<int> topics(corpus.N());
+  std::vector<int> known(M);
+  std::vector<long long> sweeps(threads);
+  std::vector<Inferer::Context> contexts(threads);
+
+  INFO("Inference begins.");
+  Scheduler scheduler;
+  scheduler.Init(&docs[0], M, threads);
+  scheduler.Run(
+      [&](int t, int m_begin, int m_end) {
+        Inferer::Context* context = &contexts[t];
+        std::vector<int> buffer;
+        for (int m = m_begin; m < m_end; m++) {
+          sweeps[t] += inferer.InferDocument(corpus.DocWords(m, &buffer),
+                                             docs[m + 1] - docs[m], context);
+          known[m] = static_cast<int>(context->topics.size());
+          std::copy(context->topics.begin(), context->topics.end(),
+                    topics.begin() + docs[m]);
+        }
+      },
+      true);
+  scheduler.Report("Inference");
+  long long total_sweeps = 0;
+  for (long long s : sweeps) {
+    total_sweeps += s;
+  }
+  INFO("Inference ended, %lg sweeps per document.",
+       M ? total_sweeps * 1.0 / M : 0.0);
+
+  INFO("Saving topic distributions.");
+  std::ofstream ofs(output_filename.c_str());
+  CHECK(ofs.is_open());
+  std::vector<double> theta(K);
+  for (int m = 0; m < M; m++) {
+    inferer.GetDocTopicDistribution(topics.data() + docs[m], known[m],
+                                    &theta[0]);
+    for (int k = 0; k < K; k++) {
+      if (k) {
+        ofs << ' ';
+      }
+      ofs << theta[k];
+    }
+    ofs << '\n';
+  }
+  CHECK(ofs.good());
+  return 0;
+}
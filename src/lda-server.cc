@@ -0,0 +1,192 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// LDA inference server main
+//
+
+#include <signal.h>
+#include <string>
+#include "args.h"
+#include "infer_server.h"
+#include "x.h"
+
+namespace {
+
+// input options
+std::string model_filename;
+std::string alias_filename;
+std::string socket_path;
+
+// inference options
+int mh_step = 2;
+int max_sweeps = 50;
+double stop_ratio = 0.05;
+
+// server options
+int threads = 1;
+int max_batch = 32;
+int batch_wait_us = 200;
+int report_interval = 60;
+int max_request_size = 1 << 20;
+
+InferServer* server;
+
+void OnSignal(int sig) { server->Stop(); }
+
+void Usage() {
+  fprintf(stderr,
+          "Usage: lda-server [options] MODEL_FILE SOCKET_PATH\n"
+          "  MODEL_FILE: binary model written by lda-train,\n"
+          "    OUTPUT_PREFIX-model.bin.\n"
+          "  SOCKET_PATH: path of the Unix domain socket to listen on.\n"
+          "\n"
+          "  A client sends a document as a line of word ids,\n"
+          "  and receives a line of probabilities of all topics,\n"
+          "  or a line beginning with \"ERROR\".\n"
+          "  Words not in the model are ignored.\n"
+          "  SIGINT or SIGTERM stops the server.\n"
+          "\n"
+          "  Options:\n"
+          "    -alias_file ALIAS_FILE\n"
+          "      File of precomputed word proposals of MODEL_FILE.\n"
+          "      It is mapped if it matches MODEL_FILE, or else\n"
+          "      it is built and saved, so later runs start instantly\n"
+          "      and processes share it in the page cache.\n"
+          "      Default is \"%s\", building them in memory.\n"
+          "    -mh_step MH_STEP\n"
+          "      Number of MH steps.\n"
+          "      Default is \"%d\".\n"
+          "    -max_sweeps SWEEPS\n"
+          "      Maximum number of sweeps over each document.\n"
+          "      Default is \"%d\".\n"
+          "    -stop_ratio RATIO\n"
+          "      Stop sampling a document after a sweep where\n"
+          "      no more than RATIO of its words change topics.\n"
+          "      Default is \"%lg\".\n"
+          "    -threads THREADS\n"
+          "      Number of inference threads.\n"
+          "      Default is \"%d\".\n"
+          "    -max_batch SIZE\n"
+          "      Maximum number of requests in a batch.\n"
+          "      Default is \"%d\".\n"
+          "    -batch_wait_us MICROSECONDS\n"
+          "      Maximum time a request waits for its batch to fill.\n"
+          "      Default is \"%d\".\n"
+          "    -report_interval SECONDS\n"
+          "      Interval of reporting throughput and latency,\n"
+          "      0 disables it.\n"
+          "      Default is \"%d\".\n"
+          "    -max_request_size BYTES\n"
+          "      Maximum length of a request line.\n"
+          "      Default is \"%d\".\n",
+          alias_filename.c_str(), mh_step, max_sweeps, stop_ratio, threads,
+          max_batch, batch_wait_us, report_interval, max_request_size);
+  exit(1);
+}
+
+void ParseArgs(int argc, char** argv) {
+  if (argc == 1) {
+    Usage();
+  }
+
+  int i = 1;
+  for (;;) {
+    std::string s = argv[i];
+    if (s == "-h" || s == "-help" || s == "--help") {
+      Usage();
+    }
+
+    if (s.size() >= 2 && s[0] == '-' && s[1] == '-') {
+      s.erase(s.begin());
+    }
+
+    if (s == "-alias_file") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      alias_filename = argv[i + 1];
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-mh_step") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      mh_step = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-max_sweeps") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      max_sweeps = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-stop_ratio") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      stop_ratio = xatod(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-threads") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      threads = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-max_batch") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      max_batch = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-batch_wait_us") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      batch_wait_us = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-report_interval") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      report_interval = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-max_request_size") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      max_request_size = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else {
+      i++;
+    }
+    if (i == argc) {
+      break;
+    }
+  }
+
+  if (argc != 3) {
+    Usage();
+  }
+
+  CHECK(mh_step > 0);
+  CHECK(max_sweeps > 0);
+  CHECK(stop_ratio >= 0.0);
+  CHECK(threads >= 1);
+  CHECK(max_batch >= 1);
+  CHECK(batch_wait_us >= 0);
+  CHECK(report_interval >= 0);
+  CHECK(max_request_size >= 1);
+
+  model_filename = argv[1];
+  socket_path = argv[2];
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ParseArgs(argc, argv);
+
+  Inferer inferer;
+  inferer.mh_step() = mh_step;
+  inferer.max_sweeps() = max_sweeps;
+  inferer.stop_ratio() = stop_ratio;
+  if (alias_filename.empty()) {
+    CHECK(inferer.LoadModel(model_filename));
+  } else {
+    CHECK(inferer.LoadModel(model_filename, alias_filename));
+  }
+
+  InferServer infer_server(&inferer);
+  infer_server.workers() = threads;
+  infer_server.max_batch() = max_batch;
+  infer_server.batch_wait_us() = batch_wait_us;
+  infer_server.report_interval() = report_interval;
+  infer_server.max_request_size() = max_request_size;
+  CHECK(infer_server.Listen(socket_path));
+
+  server = &infer_server;
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+  infer_server.Run();
+  return 0;
+}
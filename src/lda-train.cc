@@ -4,44 +4,30 @@
 // LDA train main
 //
 
-#include <errno.h>
-#include <stdlib.h>
+#include <memory>
 #include <string>
-#include "sampler.h"
+#include "args.h"
+#include "lda.h"
 #include "x.h"
 
 namespace {
 
 // input options
-int doc_with_id;
 std::string input_corpus_filename;
 
 // output options
 std::string output_prefix;
+std::string model_format = "both";
 
-// sampler options
-std::string sampler = "lightlda";
-int K = 10;
-double alpha = 0.1;
-double beta = 0.1;
-int hp_opt = 0;
-int hp_opt_interval = 5;
-double hp_opt_alpha_shape = 0.0;
-double hp_opt_alpha_scale = 100000.0;
-int hp_opt_alpha_iteration = 2;
-int hp_opt_beta_iteration = 200;
-int total_iteration = 200;
-int burnin_iteration = 10;
-int log_likelihood_interval = 10;
-int mh_step = 2;
-int enable_word_proposal = 1;
-int enable_doc_proposal = 1;
+LDAOptions options;
 
 void Usage() {
   fprintf(
       stderr,
       "Usage: lda-train [options] INPUT_FILE [OUTPUT_PREFIX]\n"
       "  INPUT_FILE: input corpus filename.\n"
+      "    A binary corpus converted by lda-convert is also accepted.\n"
+      "    A text corpus may be gzip or zstd compressed.\n"
       "  OUTPUT_PREFIX: output filename prefix.\n"
       "    Default is the same as INPUT_FILE.\n"
       "\n"
@@ -49,6 +35,26 @@ void Usage() {
       "    -doc_with_id 0/1\n"
       "      Whether the first column of INPUT_FILE is doc ID, and skip it.\n"
       "      Default is \"%d\".\n"
+      "    -run_length 0/1\n"
+      "      Whether to store repeated words of a document,\n"
+      "      like \"id:count\", as (id, count) runs to save memory"
+      "(stream = 0).\n"
+      "      Default is \"%d\".\n"
+      "    -remap_words 0/1\n"
+      "      Whether to renumber words in descending order of frequency,\n"
+      "      so that counts of frequent words are adjacent in memory.\n"
+      "      Output still uses the original word IDs.\n"
+      "      Default is \"%d\".\n"
+      "    -group_words 0/1\n"
+      "      Whether to sort words of each document by word ID,\n"
+      "      so that samplers reuse per word states of repeated words.\n"
+      "      Default is \"%d\".\n"
+      "    -model_format text/binary/both\n"
+      "      Format of the output model. text writes OUTPUT_PREFIX-meta,\n"
+      "      OUTPUT_PREFIX-topic-count and OUTPUT_PREFIX-word-topic-count.\n"
+      "      binary writes OUTPUT_PREFIX-model.bin, which can be mapped\n"
+      "      into memory without parsing.\n"
+      "      Default is \"%s\".\n"
       "    -sampler lda/sparselda/aliaslda/lightlda\n"
       "      Different sampling algorithms.\n"
       "      Default is \"%s\".\n"
@@ -99,63 +105,66 @@ void Usage() {
       "      Default is \"%d\".\n"
       "    -enable_doc_proposal 0/1\n"
       "      Enable doc proposal(sampler=lightlda).\n"
+      "      Default is \"%d\".\n"
+      "    -threads THREADS\n"
+      "      Number of sampling threads. "
+      "Documents are partitioned among threads.\n"
+      "      Default is \"%d\".\n"
+      "    -model_parallel 0/1\n"
+      "      Whether to also partition the vocabulary among threads "
+      "and rotate it,\n"
+      "      instead of merging word-topic counts(threads > 1).\n"
+      "      Default is \"%d\".\n"
+      "    -hogwild 0/1\n"
+      "      Whether threads update shared word-topic counts in place\n"
+      "      through lock-free tables(sampler=lightlda, threads > 1).\n"
+      "      Default is \"%d\".\n"
+      "    -processes PROCESSES\n"
+      "      Number of training processes on this host.\n"
+      "      Documents are partitioned among processes,\n"
+      "      which synchronize counts through shared memory.\n"
+      "      Output is written by process 0.\n"
+      "      On NUMA hosts, run one process per socket and bind it\n"
+      "      there, e.g. numactl --cpunodebind=ID --membind=ID.\n"
+      "      Default is \"%d\".\n"
+      "    -process_id ID\n"
+      "      ID of this process, in [0, PROCESSES).\n"
+      "      Default is \"%d\".\n"
+      "    -shm_name NAME\n"
+      "      Name of the shared memory(processes > 1).\n"
+      "      Default is \"%s\".\n"
+      "    -stream 0/1\n"
+      "      Whether to keep documents on disk in OUTPUT_PREFIX-stream,\n"
+      "      and sample them block by block. Only counts stay in memory.\n"
+      "      Default is \"%d\".\n"
+      "    -stream_block_words WORDS\n"
+      "      Number of words of a block(stream = 1).\n"
+      "      Default is \"%d\".\n"
+      "    -checkpoint_interval INTERVAL\n"
+      "      Interval of saving sampler states to OUTPUT_PREFIX-checkpoint\n"
+      "      (OUTPUT_PREFIX-checkpoint-ID if processes > 1) in background\n"
+      "      (stream = 0). 0 disables it.\n"
+      "      Default is \"%d\".\n"
+      "    -resume 0/1\n"
+      "      Whether to resume training from the checkpoint,\n"
+      "      which requires the same corpus and options.\n"
+      "      It repeats an uninterrupted run exactly only if threads = 1.\n"
       "      Default is \"%d\".\n",
-      doc_with_id, sampler.c_str(), K, alpha, beta, hp_opt, hp_opt_interval,
-      hp_opt_alpha_shape, hp_opt_alpha_scale, hp_opt_alpha_iteration,
-      hp_opt_beta_iteration, total_iteration, burnin_iteration,
-      log_likelihood_interval, mh_step, enable_word_proposal,
-      enable_doc_proposal);
+      options.doc_with_id, options.run_length, options.remap_words,
+      options.group_words, model_format.c_str(), options.sampler.c_str(),
+      options.K, options.alpha, options.beta, options.hp_opt,
+      options.hp_opt_interval, options.hp_opt_alpha_shape,
+      options.hp_opt_alpha_scale, options.hp_opt_alpha_iteration,
+      options.hp_opt_beta_iteration, options.total_iteration,
+      options.burnin_iteration, options.log_likelihood_interval,
+      options.mh_step, options.enable_word_proposal,
+      options.enable_doc_proposal, options.threads, options.model_parallel,
+      options.hogwild, options.processes, options.process_id,
+      options.shm_name.c_str(), options.stream, options.stream_block_words,
+      options.checkpoint_interval, options.resume);
   exit(1);
 }
 
-#define COMSUME_1_ARG(argc, argv, i)     \
-  do {                                   \
-    for (int j = i; j < argc - 1; j++) { \
-      argv[j] = argv[j + 1];             \
-    }                                    \
-    argc -= 1;                           \
-  } while (0)
-
-#define COMSUME_2_ARG(argc, argv, i)     \
-  do {                                   \
-    for (int j = i; j < argc - 2; j++) { \
-      argv[j] = argv[j + 2];             \
-    }                                    \
-    argc -= 2;                           \
-  } while (0)
-
-#define CHECK_MISSING_ARG(argc, argv, i, action)  \
-  do {                                            \
-    if (i + 1 == argc) {                          \
-      ERROR("\"%s\" requires a value.", argv[i]); \
-      action;                                     \
-    }                                             \
-  } while (0)
-
-inline double xatod(const char* str) {
-  char* endptr;
-  double d;
-  errno = 0;
-  d = strtod(str, &endptr);
-  if (errno != 0 || str == endptr) {
-    ERROR("\"%s\" is not a double.", str);
-    exit(1);
-  }
-  return d;
-}
-
-inline int xatoi(const char* str) {
-  char* endptr;
-  int i;
-  errno = 0;
-  i = static_cast<int>(strtol(str, &endptr, 10));
-  if (errno != 0 || str == endptr) {
-    ERROR("\"%s\" is not an integer.", str);
-    exit(1);
-  }
-  return i;
-}
-
 void ParseArgs(int argc, char** argv) {
   if (argc == 1) {
     Usage();
@@ -174,71 +183,127 @@ void ParseArgs(int argc, char** argv) {
 
     if (s == "-doc_with_id") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      doc_with_id = xatoi(argv[i + 1]);
+      options.doc_with_id = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-run_length") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.run_length = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-remap_words") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.remap_words = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-group_words") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.group_words = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-model_format") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      model_format = argv[i + 1];
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-sampler") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      sampler = argv[i + 1];
+      options.sampler = argv[i + 1];
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-K") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      K = xatoi(argv[i + 1]);
+      options.K = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-alpha") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      alpha = xatod(argv[i + 1]);
+      options.alpha = xatod(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-beta") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      beta = xatod(argv[i + 1]);
+      options.beta = xatod(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-hp_opt") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      hp_opt = xatoi(argv[i + 1]);
+      options.hp_opt = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-hp_opt_interval") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      hp_opt_interval = xatoi(argv[i + 1]);
+      options.hp_opt_interval = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-hp_opt_alpha_shape") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      hp_opt_alpha_shape = xatod(argv[i + 1]);
+      options.hp_opt_alpha_shape = xatod(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-hp_opt_alpha_scale") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      hp_opt_alpha_scale = xatod(argv[i + 1]);
+      options.hp_opt_alpha_scale = xatod(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-hp_opt_alpha_iteration") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      hp_opt_alpha_iteration = xatoi(argv[i + 1]);
+      options.hp_opt_alpha_iteration = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-hp_opt_beta_iteration") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      hp_opt_beta_iteration = xatoi(argv[i + 1]);
+      options.hp_opt_beta_iteration = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-total_iteration") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      total_iteration = xatoi(argv[i + 1]);
+      options.total_iteration = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-burnin_iteration") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      burnin_iteration = xatoi(argv[i + 1]);
+      options.burnin_iteration = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-log_likelihood_interval") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      log_likelihood_interval = xatoi(argv[i + 1]);
+      options.log_likelihood_interval = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-mh_step") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      mh_step = xatoi(argv[i + 1]);
+      options.mh_step = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-enable_word_proposal") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      enable_word_proposal = xatoi(argv[i + 1]);
+      options.enable_word_proposal = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else if (s == "-enable_doc_proposal") {
       CHECK_MISSING_ARG(argc, argv, i, Usage());
-      enable_doc_proposal = xatoi(argv[i + 1]);
+      options.enable_doc_proposal = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-threads") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.threads = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-model_parallel") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.model_parallel = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-hogwild") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.hogwild = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-processes") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.processes = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-process_id") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.process_id = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-shm_name") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.shm_name = argv[i + 1];
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-stream") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.stream = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-stream_block_words") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.stream_block_words = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-checkpoint_interval") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.checkpoint_interval = xatoi(argv[i + 1]);
+      COMSUME_2_ARG(argc, argv, i);
+    } else if (s == "-resume") {
+      CHECK_MISSING_ARG(argc, argv, i, Usage());
+      options.resume = xatoi(argv[i + 1]);
       COMSUME_2_ARG(argc, argv, i);
     } else {
       i++;
@@ -252,30 +317,8 @@ void ParseArgs(int argc, char** argv) {
     Usage();
   }
 
-  CHECK(doc_with_id == 0 || doc_with_id == 1);
-  CHECK(sampler == "lda" || sampler == "sparselda" || sampler == "aliaslda" ||
-        sampler == "lightlda");
-  CHECK(K >= 2);
-  CHECK(alpha >= 0.0);
-  CHECK(beta > 0.0);
-  CHECK(hp_opt >= 0 && hp_opt <= 1);
-  CHECK(hp_opt_interval > 0);
-  CHECK(hp_opt_alpha_shape >= 0.0);
-  CHECK(hp_opt_alpha_scale > 0.0);
-  CHECK(hp_opt_alpha_iteration >= 0);
-  CHECK(hp_opt_beta_iteration >= 0);
-  CHECK(total_iteration > 0);
-  CHECK(burnin_iteration >= 0);
-  CHECK(total_iteration > burnin_iteration);
-  CHECK(log_likelihood_interval >= 0);
-  if (sampler == "aliaslda" || sampler == "lightlda") {
-    CHECK(mh_step > 0);
-  }
-  if (sampler == "lightlda") {
-    CHECK(enable_word_proposal >= 0 && enable_word_proposal <= 1);
-    CHECK(enable_doc_proposal >= 0 && enable_doc_proposal <= 1);
-    CHECK(enable_word_proposal + enable_doc_proposal != 0);
-  }
+  CHECK(model_format == "text" || model_format == "binary" ||
+        model_format == "both");
 
   input_corpus_filename = argv[1];
   if (argc >= 3) {
@@ -283,27 +326,11 @@ void ParseArgs(int argc, char** argv) {
   } else {
     output_prefix = input_corpus_filename;
   }
-}
-
-template <class Sampler>
-void Train(Sampler* p) {
-  p->K() = K;
-  p->alpha() = alpha;
-  p->beta() = beta;
-  p->hp_opt() = hp_opt;
-  p->hp_opt_interval() = hp_opt_interval;
-  p->hp_opt_alpha_shape() = hp_opt_alpha_shape;
-  p->hp_opt_alpha_scale() = hp_opt_alpha_scale;
-  p->hp_opt_alpha_iteration() = hp_opt_alpha_iteration;
-  p->hp_opt_beta_iteration() = hp_opt_beta_iteration;
-  p->total_iteration() = total_iteration;
-  p->burnin_iteration() = burnin_iteration;
-  p->log_likelihood_interval() = log_likelihood_interval;
-
-  CHECK(p->LoadCorpus(input_corpus_filename, doc_with_id != 0));
-  p->Train();
-  CHECK(p->SaveModel(output_prefix));
-  delete p;
+  options.stream_filename = output_prefix + "-stream";
+  options.checkpoint_filename = output_prefix + "-checkpoint";
+  if (options.processes > 1) {
+    options.checkpoint_filename += "-" + std::to_string(options.process_id);
+  }
 }
 
 }  // namespace
@@ -311,22 +338,17 @@ void Train(Sampler* p) {
 int main(int argc, char** argv) {
   ParseArgs(argc, argv);
 
-  if (sampler == "lda") {
-    GibbsSampler* p = new GibbsSampler();
-    Train(p);
-  } else if (sampler == "sparselda") {
-    SparseLDASampler* p = new SparseLDASampler();
-    Train(p);
-  } else if (sampler == "aliaslda") {
-    AliasLDASampler* p = new AliasLDASampler();
-    p->mh_step() = mh_step;
-    Train(p);
-  } else if (sampler == "lightlda") {
-    LightLDASampler* p = new LightLDASampler();
-    p->mh_step() = mh_step;
-    p->enable_word_proposal() = enable_word_proposal;
-    p->enable_doc_proposal() = enable_doc_proposal;
-    Train(p);
+  std::unique_ptr<LDA> lda(LDA::Create(options));
+  CHECK(lda != nullptr);
+  CHECK(lda->LoadCorpus(input_corpus_filename));
+  lda->Train();
+  if (options.process_id == 0) {
+    if (model_format != "binary") {
+      CHECK(lda->SaveModel(output_prefix));
+    }
+    if (model_format != "text") {
+      CHECK(lda->SaveBinaryModel(output_prefix + "-model.bin"));
+    }
   }
   return 0;
 }
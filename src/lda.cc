@@ -0,0 +1,291 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "lda.h"
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include "sampler.h"
+#include "x.h"
+
+#define CHECK_OPTION(expr)                   \
+  do {                                       \
+    if (!(expr)) {                           \
+      ERROR("Bad option: \"%s\".", #expr);   \
+      return false;                          \
+    }                                        \
+  } while (0)
+
+LDAOptions::LDAOptions()
+    : doc_with_id(0),
+      run_length(0),
+      remap_words(0),
+      group_words(0),
+      stream(0),
+      stream_block_words(1 << 24),
+      sampler("lightlda"),
+      K(10),
+      alpha(0.1),
+      beta(0.1),
+      hp_opt(0),
+      hp_opt_interval(5),
+      hp_opt_alpha_shape(0.0),
+      hp_opt_alpha_scale(100000.0),
+      hp_opt_alpha_iteration(2),
+      hp_opt_beta_iteration(200),
+      total_iteration(200),
+      burnin_iteration(10),
+      log_likelihood_interval(10),
+      mh_step(2),
+      enable_word_proposal(1),
+      enable_doc_proposal(1),
+      threads(1),
+      model_parallel(0),
+      hogwild(0),
+      processes(1),
+      process_id(0),
+      shm_name("lda-train"),
+      checkpoint_interval(0),
+      resume(0) {}
+
+bool LDAOptions::Check() const {
+  CHECK_OPTION(doc_with_id == 0 || doc_with_id == 1);
+  CHECK_OPTION(run_length == 0 || run_length == 1);
+  CHECK_OPTION(remap_words == 0 || remap_words == 1);
+  CHECK_OPTION(group_words == 0 || group_words == 1);
+  CHECK_OPTION(sampler == "lda" || sampler == "sparselda" ||
+               sampler == "aliaslda" || sampler == "lightlda");
+  CHECK_OPTION(K >= 2);
+  CHECK_OPTION(alpha >= 0.0);
+  CHECK_OPTION(beta > 0.0);
+  CHECK_OPTION(hp_opt >= 0 && hp_opt <= 1);
+  CHECK_OPTION(hp_opt_interval > 0);
+  CHECK_OPTION(hp_opt_alpha_shape >= 0.0);
+  CHECK_OPTION(hp_opt_alpha_scale > 0.0);
+  CHECK_OPTION(hp_opt_alpha_iteration >= 0);
+  CHECK_OPTION(hp_opt_beta_iteration >= 0);
+  CHECK_OPTION(total_iteration > 0);
+  CHECK_OPTION(burnin_iteration >= 0);
+  CHECK_OPTION(total_iteration > burnin_iteration);
+  CHECK_OPTION(log_likelihood_interval >= 0);
+  CHECK_OPTION(threads >= 1);
+  CHECK_OPTION(model_parallel == 0 || model_parallel == 1);
+  CHECK_OPTION(hogwild == 0 || hogwild == 1);
+  if (hogwild) {
+    CHECK_OPTION(sampler == "lightlda");
+    CHECK_OPTION(model_parallel == 0);
+  }
+  CHECK_OPTION(processes >= 1);
+  CHECK_OPTION(process_id >= 0 && process_id < processes);
+  if (processes > 1) {
+    CHECK_OPTION(hp_opt == 0);
+    CHECK_OPTION(!shm_name.empty());
+  }
+  CHECK_OPTION(stream == 0 || stream == 1);
+  if (stream) {
+    CHECK_OPTION(!stream_filename.empty());
+    CHECK_OPTION(stream_block_words > 0);
+    CHECK_OPTION(hp_opt == 0);
+    CHECK_OPTION(model_parallel == 0);
+    CHECK_OPTION(processes == 1);
+    CHECK_OPTION(run_length == 0);
+  }
+  CHECK_OPTION(checkpoint_interval >= 0);
+  CHECK_OPTION(resume == 0 || resume == 1);
+  if (checkpoint_interval > 0 || resume) {
+    CHECK_OPTION(!checkpoint_filename.empty());
+    CHECK_OPTION(stream == 0);
+  }
+  if (sampler == "aliaslda" || sampler == "lightlda") {
+    CHECK_OPTION(mh_step > 0);
+  }
+  if (sampler == "lightlda") {
+    CHECK_OPTION(enable_word_proposal >= 0 && enable_word_proposal <= 1);
+    CHECK_OPTION(enable_doc_proposal >= 0 && enable_doc_proposal <= 1);
+    CHECK_OPTION(enable_word_proposal + enable_doc_proposal != 0);
+  }
+  return true;
+}
+
+namespace {
+
+template <class Sampler>
+class LDAImpl : public LDA {
+ private:
+  LDAOptions options_;
+  std::unique_ptr<Sampler> sampler_;
+  // new_ids_[v]: row of original word "v" if words are remapped
+  std::vector<int> new_ids_;
+
+ public:
+  LDAImpl(const LDAOptions& options, Sampler* sampler)
+      : options_(options), sampler_(sampler) {
+    Sampler* p = sampler_.get();
+    p->K() = options.K;
+    p->alpha() = options.alpha;
+    p->beta() = options.beta;
+    p->hp_opt() = options.hp_opt;
+    p->hp_opt_interval() = options.hp_opt_interval;
+    p->hp_opt_alpha_shape() = options.hp_opt_alpha_shape;
+    p->hp_opt_alpha_scale() = options.hp_opt_alpha_scale;
+    p->hp_opt_alpha_iteration() = options.hp_opt_alpha_iteration;
+    p->hp_opt_beta_iteration() = options.hp_opt_beta_iteration;
+    p->total_iteration() = options.total_iteration;
+    p->burnin_iteration() = options.burnin_iteration;
+    p->log_likelihood_interval() = options.log_likelihood_interval;
+    p->threads() = options.threads;
+    p->model_parallel() = options.model_parallel;
+    p->hogwild() = options.hogwild;
+    p->processes() = options.processes;
+    p->process_id() = options.process_id;
+    p->shm_name() = options.shm_name;
+    p->checkpoint_interval() = options.checkpoint_interval;
+    p->resume() = options.resume;
+    p->checkpoint_filename() = options.checkpoint_filename;
+  }
+
+  virtual bool LoadCorpus(const std::string& filename) override {
+    if (options_.stream) {
+      if (!sampler_->LoadStreamCorpus(
+              filename, options_.doc_with_id != 0, options_.stream_filename,
+              options_.stream_block_words, options_.remap_words != 0,
+              options_.group_words != 0)) {
+        return false;
+      }
+      InitNewIds();
+      return true;
+    }
+
+    if (!sampler_->LoadCorpus(filename, options_.doc_with_id != 0,
+                              options_.run_length != 0)) {
+      return false;
+    }
+    PrepareCorpus();
+    return true;
+  }
+
+  virtual bool SetCorpus(const int* docs, int M, const int* words,
+                         int V) override {
+    if (options_.stream) {
+      ERROR("Streaming is not supported for caller owned documents.");
+      return false;
+    }
+    if (!sampler_->SetCorpus(docs, M, words, V, options_.run_length != 0)) {
+      return false;
+    }
+    PrepareCorpus();
+    return true;
+  }
+
+  virtual void Train(const IterationCallback& callback) override {
+    sampler_->iteration_callback() = callback;
+    sampler_->Train();
+    sampler_->iteration_callback() = nullptr;
+  }
+
+  virtual double LogLikelihood() override {
+    CHECK(sampler_->trained());
+    return sampler_->ReduceLogLikelihood(sampler_->CorpusLogLikelihood());
+  }
+
+  virtual int K() const override { return options_.K; }
+  virtual int V() const override { return sampler_->V(); }
+  virtual int M() const override { return sampler_->total_docs(); }
+
+  virtual int TopicCount(int k) const override {
+    return sampler_->topics_count()[k];
+  }
+
+  virtual void GetWordTopicCounts(
+      int v, std::vector<std::pair<int, int> >* counts) const override {
+    const int row = new_ids_.empty() ? v : new_ids_[v];
+    GetCounts(sampler_->words_topics_count()[row], counts);
+  }
+
+  virtual void GetDocTopicCounts(
+      int m, std::vector<std::pair<int, int> >* counts) const override {
+    GetCounts(sampler_->docs_topics_count()[m], counts);
+  }
+
+  virtual bool SaveModel(const std::string& prefix) const override {
+    return sampler_->SaveModel(prefix);
+  }
+
+  virtual bool SaveBinaryModel(const std::string& filename) const override {
+    return sampler_->SaveBinaryModel(filename);
+  }
+
+ private:
+  void PrepareCorpus() {
+    if (options_.remap_words) {
+      sampler_->RemapWords();
+    }
+    if (options_.group_words) {
+      sampler_->GroupDocWords();
+    }
+    InitNewIds();
+  }
+
+  void InitNewIds() {
+    const std::vector<int>& word_ids = sampler_->word_ids();
+    new_ids_.assign(word_ids.size(), 0);
+    for (int v = 0; v < static_cast<int>(word_ids.size()); v++) {
+      new_ids_[word_ids[v]] = v;
+    }
+  }
+
+  template <class Table>
+  static void GetCounts(const Table& table,
+                        std::vector<std::pair<int, int> >* counts) {
+    counts->clear();
+    for (auto first = table.begin(), last = table.end(); first != last;
+         ++first) {
+      counts->emplace_back(first.id(), first.count());
+    }
+    std::sort(counts->begin(), counts->end());
+  }
+};
+
+// "Topic" is the type of topic ids of words
+template <class Topic>
+LDA* CreateLDA(const LDAOptions& options) {
+  if (options.sampler == "lda") {
+    return new LDAImpl<GibbsSamplerT<Topic> >(options,
+                                              new GibbsSamplerT<Topic>());
+  } else if (options.sampler == "sparselda") {
+    return new LDAImpl<SparseLDASamplerT<Topic> >(
+        options, new SparseLDASamplerT<Topic>());
+  } else if (options.sampler == "aliaslda") {
+    AliasLDASamplerT<Topic>* p = new AliasLDASamplerT<Topic>();
+    p->mh_step() = options.mh_step;
+    return new LDAImpl<AliasLDASamplerT<Topic> >(options, p);
+  } else if (options.hogwild) {
+    // Hogwild LightLDA: workers update shared word-topic rows in place
+    typedef LightLDASamplerT<ConcurrentHashTables, Topic> SamplerType;
+    SamplerType* p = new SamplerType();
+    p->mh_step() = options.mh_step;
+    p->enable_word_proposal() = options.enable_word_proposal;
+    p->enable_doc_proposal() = options.enable_doc_proposal;
+    return new LDAImpl<SamplerType>(options, p);
+  } else {
+    typedef LightLDASamplerT<HybridHashTables, Topic> SamplerType;
+    SamplerType* p = new SamplerType();
+    p->mh_step() = options.mh_step;
+    p->enable_word_proposal() = options.enable_word_proposal;
+    p->enable_doc_proposal() = options.enable_doc_proposal;
+    return new LDAImpl<SamplerType>(options, p);
+  }
+}
+
+}  // namespace
+
+LDA* LDA::Create(const LDAOptions& options) {
+  if (!options.Check()) {
+    return nullptr;
+  }
+  if (options.K <= 65536) {
+    return CreateLDA<uint16_t>(options);
+  }
+  return CreateLDA<int>(options);
+}
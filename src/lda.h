@@ -0,0 +1,108 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// LDA training library API
+//
+
+#ifndef LDA_H_
+#define LDA_H_
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+// See "lda-train" for the meaning of options.
+struct LDAOptions {
+  // corpus options
+  int doc_with_id;
+  int run_length;
+  int remap_words;
+  int group_words;
+  int stream;
+  std::string stream_filename;
+  int stream_block_words;
+
+  // sampler options
+  std::string sampler;
+  int K;
+  double alpha;
+  double beta;
+  int hp_opt;
+  int hp_opt_interval;
+  double hp_opt_alpha_shape;
+  double hp_opt_alpha_scale;
+  int hp_opt_alpha_iteration;
+  int hp_opt_beta_iteration;
+  int total_iteration;
+  int burnin_iteration;
+  int log_likelihood_interval;  // 0 disables it
+  int mh_step;
+  int enable_word_proposal;
+  int enable_doc_proposal;
+
+  // parallel options
+  int threads;
+  int model_parallel;
+  int hogwild;
+  int processes;
+  int process_id;
+  std::string shm_name;
+
+  // checkpoint options
+  int checkpoint_interval;
+  int resume;
+  std::string checkpoint_filename;
+
+  LDAOptions();
+
+  // Return false and report the first bad option.
+  bool Check() const;
+};
+
+// An LDA trainer with the sampler chosen by options:
+// "Create", "LoadCorpus" or "SetCorpus", "Train",
+// and then read counts or save the model.
+// Word ids are always those of the input corpus,
+// even if words are remapped internally.
+class LDA {
+ public:
+  // called after each iteration with the iteration,
+  // training stops if it returns false
+  typedef std::function<bool(int)> IterationCallback;
+
+  // Return nullptr if options are bad.
+  static LDA* Create(const LDAOptions& options);
+  virtual ~LDA() {}
+
+  // Load a text or binary corpus, or create a streaming corpus.
+  virtual bool LoadCorpus(const std::string& filename) = 0;
+  // Use caller owned documents like "Corpus::SetCorpus",
+  // "words" is not copied unless it has to be modified
+  // or "run_length" is set. Streaming is not supported.
+  virtual bool SetCorpus(const int* docs, int M, const int* words, int V) = 0;
+
+  // Train the model, it may only be called once.
+  virtual void Train(const IterationCallback& callback = nullptr) = 0;
+  // Return the log likelihood of the whole corpus after "Train",
+  // with multiple processes, all of them must call it together.
+  virtual double LogLikelihood() = 0;
+
+  virtual int K() const = 0;
+  virtual int V() const = 0;
+  virtual int M() const = 0;
+  virtual int TopicCount(int k) const = 0;
+  // Get (topic, count) pairs of word "v" in ascending order of topics.
+  virtual void GetWordTopicCounts(
+      int v, std::vector<std::pair<int, int> >* counts) const = 0;
+  // Get (topic, count) pairs of document "m" of this process
+  // in ascending order of topics. Streaming is not supported.
+  virtual void GetDocTopicCounts(
+      int m, std::vector<std::pair<int, int> >* counts) const = 0;
+
+  // See "Model::SaveModel" and "Model::SaveBinaryModel".
+  virtual bool SaveModel(const std::string& prefix) const = 0;
+  virtual bool SaveBinaryModel(const std::string& filename) const = 0;
+};
+
+#endif  // LDA_H_
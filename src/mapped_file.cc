@@ -0,0 +1,85 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "mapped_file.h"
+#include "x.h"
+
+#if defined _WIN32
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined _WIN32
+bool MappedFile::Open(const std::string& filename) {
+  Close();
+  std::ifstream ifs(filename.c_str(), std::ios::binary);
+  if (!ifs.is_open()) {
+    ERROR("Failed to open \"%s\".", filename.c_str());
+    return false;
+  }
+
+  ifs.seekg(0, std::ios::end);
+  buffer_.resize(static_cast<size_t>(ifs.tellg()));
+  ifs.seekg(0, std::ios::beg);
+  if (!buffer_.empty() && !ifs.read(&buffer_[0], buffer_.size())) {
+    ERROR("Failed to read \"%s\".", filename.c_str());
+    buffer_.clear();
+    return false;
+  }
+  addr_ = buffer_.empty() ? nullptr : &buffer_[0];
+  size_ = buffer_.size();
+  return true;
+}
+
+void MappedFile::Close() {
+  buffer_.clear();
+  buffer_.shrink_to_fit();
+  addr_ = nullptr;
+  size_ = 0;
+}
+#else
+bool MappedFile::Open(const std::string& filename) {
+  Close();
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd == -1) {
+    ERROR("Failed to open \"%s\".", filename.c_str());
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == -1) {
+    ERROR("Failed to stat \"%s\".", filename.c_str());
+    close(fd);
+    return false;
+  }
+
+  size_ = static_cast<size_t>(st.st_size);
+  if (size_ == 0) {
+    close(fd);
+    return true;
+  }
+
+  addr_ = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr_ == MAP_FAILED) {
+    ERROR("Failed to map \"%s\".", filename.c_str());
+    addr_ = nullptr;
+    size_ = 0;
+    return false;
+  }
+  return true;
+}
+
+void MappedFile::Close() {
+  if (addr_) {
+    munmap(addr_, size_);
+    addr_ = nullptr;
+  }
+  size_ = 0;
+}
+#endif
@@ -0,0 +1,34 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// read-only memory mapped file
+//
+
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+// On platforms without "mmap", the file is read into memory instead.
+class MappedFile {
+ private:
+  void* addr_;
+  size_t size_;
+  std::vector<char> buffer_;
+
+ public:
+  MappedFile() : addr_(nullptr), size_(0) {}
+  ~MappedFile() { Close(); }
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  bool Open(const std::string& filename);
+  void Close();
+
+  const char* data() const { return static_cast<const char*>(addr_); }
+  size_t size() const { return size_; }
+};
+
+#endif  // MAPPED_FILE_H_
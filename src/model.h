@@ -7,27 +7,46 @@
 #ifndef MODEL_H_
 #define MODEL_H_
 
+#include <string.h>
+#include <algorithm>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 #include "corpus.h"
+#include "corpus_stream.h"
+#include "model_file.h"
 #include "rand.h"
 #include "table.h"
 #include "x.h"
 
-template <class Tables>
+// "Topic" is the type of topic ids of words,
+// a narrow type like uint16_t saves memory when K is small.
+// "Tables" stores word-topic counts, and "DocTables" doc-topic counts,
+// e.g. concurrent word rows with doc rows of a single writer each.
+template <class Tables, class Topic, class DocTables = Tables>
 class Model : public Corpus {
  public:
   typedef Tables TablesType;
   typedef typename TablesType::TableType TableType;
+  typedef DocTables DocTablesType;
+  typedef typename DocTablesType::TableType DocTableType;
+  typedef Topic TopicType;
 
  protected:
   int K_;  // # of topics
+  // topics_[i]: topic id assigned to word "i", starts from 0
+  std::vector<TopicType> topics_;
+
+  // streaming corpus:
+  // documents are stored on disk in blocks, and loaded one block at a time.
+  // "docs_", "words_", "topics_" and "M_" only hold the loaded block.
+  std::unique_ptr<CorpusStream<TopicType> > stream_;
 
   // topics_count_[k]: # of words assigned to topic k
   DenseTable topics_count_;
   // docs_topics_count_[m][k]: # of words in doc m assigned to topic k
-  TablesType docs_topics_count_;
+  DocTablesType docs_topics_count_;
   // words_topics_count_[v][k]: # of word v assigned to topic k
   TablesType words_topics_count_;
 
@@ -41,35 +60,116 @@ class Model : public Corpus {
 
   Random random_;
 
+  // topics and hyper parameters are restored from a checkpoint,
+  // and "Init" only rebuilds counts from them
+  bool restored_;
+
+  // # of docs of all processes if documents are partitioned among them,
+  // otherwise 0
+  int all_docs_;
+
  public:
-  Model() : K_(0), hp_sum_alpha_(0.0), hp_beta_(0.0) {}
+  Model()
+      : K_(0),
+        hp_sum_alpha_(0.0),
+        hp_beta_(0.0),
+        restored_(false),
+        all_docs_(0) {}
 
   int& K() { return K_; }
   double& alpha() { return hp_sum_alpha_; }
   double& beta() { return hp_beta_; }
 
+  // read only counts
+  const DenseTable& topics_count() const { return topics_count_; }
+  const TablesType& words_topics_count() const { return words_topics_count_; }
+  const DocTablesType& docs_topics_count() const {
+    return docs_topics_count_;
+  }
+
+  // Store corpus "filename" in blocks of about "block_words" words
+  // in "stream_filename" for streaming.
+  // "remap_words" and "group_words" are the same as
+  // "RemapWords" and "GroupDocWords".
+  bool LoadStreamCorpus(const std::string& filename, bool doc_with_id,
+                        const std::string& stream_filename, int block_words,
+                        bool remap_words, bool group_words) {
+    std::vector<int> new_ids;
+    if (remap_words) {
+      // an extra pass to count word frequency
+      std::vector<int> word_freq;
+      auto func = [&word_freq](const int* doc, int N) {
+        for (int n = 0; n < N; n++) {
+          if (doc[n] >= static_cast<int>(word_freq.size())) {
+            word_freq.resize(doc[n] + 1);
+          }
+          word_freq[doc[n]]++;
+        }
+      };
+      int V;
+      if (!ScanCorpus(filename, doc_with_id, func, &V)) {
+        return false;
+      }
+      word_freq.resize(V);
+      BuildWordRemap(word_freq, &new_ids);
+    }
+
+    stream_.reset(new CorpusStream<TopicType>);
+    if (!stream_->Create(filename, doc_with_id, stream_filename, block_words,
+                         remap_words ? &new_ids : nullptr, group_words)) {
+      stream_.reset();
+      return false;
+    }
+    docs_.clear();
+    words_buffer_.clear();
+    UseWordsBuffer();
+    M_ = 0;
+    V_ = stream_->V();
+    return true;
+  }
+
+  bool streaming() const { return stream_ != nullptr; }
+
+  // # of docs and words of the whole corpus
+  int total_docs() const { return stream_ ? stream_->M() : M_; }
+  long long total_words() const { return stream_ ? stream_->N() : N_; }
+  // # of docs the model is trained on, including those of other processes
+  int model_docs() const { return all_docs_ ? all_docs_ : total_docs(); }
+
+  // Begin a pass over all blocks,
+  // "write" writes topics of each block back after it is used.
+  void BeginBlocks(bool write) { stream_->Begin(write); }
+
+  // load the next block, return false after the last block
+  bool NextBlock() {
+    const bool loaded = stream_->Next(&docs_, &words_buffer_, &topics_);
+    UseWordsBuffer();
+    M_ = loaded ? static_cast<int>(docs_.size()) - 1 : 0;
+    return loaded;
+  }
+
   virtual void Init() {
     topics_count_.Init(K_);
-    docs_topics_count_.Init(M_, K_);
     words_topics_count_.Init(V_, K_);
 
     // random initialize topics
-    for (int m = 0; m < M_; m++) {
-      const int N = docs_[m + 1] - docs_[m];
-      Word* word = &words_[docs_[m]];
-      auto& doc_topics_count = docs_topics_count_[m];
-      for (int n = 0; n < N; n++, word++) {
-        const int v = word->v;
-        const int new_topic = random_.GetNext(K_);
-        word->k = new_topic;
-        ++topics_count_[new_topic];
-        ++doc_topics_count[new_topic];
-        ++words_topics_count_[v][new_topic];
+    if (streaming()) {
+      BeginBlocks(true);
+      while (NextBlock()) {
+        InitTopics();
       }
+    } else {
+      topics_.resize(N_);
+      InitTopics();
+    }
+
+    if (restored_) {
+      hp_sum_beta_ = V_ * hp_beta_;
+      return;
     }
 
     if (hp_sum_alpha_ <= 0) {
-      const double avg_doc_len = words_.size() * 1.0 / M_;
+      const double avg_doc_len = total_words() * 1.0 / total_docs();
       hp_alpha_.resize(K_, avg_doc_len / K_);
       hp_sum_alpha_ = avg_doc_len;
     } else {
@@ -83,6 +183,41 @@ class Model : public Corpus {
     hp_sum_beta_ = V_ * hp_beta_;
   }
 
+  // random initialize topics of loaded documents,
+  // or count restored topics
+  void InitTopics() {
+    docs_topics_count_.Init(M_, K_);
+    std::vector<int> buffer;
+    for (int m = 0; m < M_; m++) {
+      auto& doc_topics_count = docs_topics_count_[m];
+      doc_topics_count.Reserve(docs_[m + 1] - docs_[m]);
+      const int* words = DocWords(m, &buffer);
+      for (int i = docs_[m], end = docs_[m + 1]; i < end; i++) {
+        const int v = *words++;
+        const int new_topic =
+            restored_ ? static_cast<int>(topics_[i]) : random_.GetNext(K_);
+        topics_[i] = static_cast<TopicType>(new_topic);
+        ++topics_count_[new_topic];
+        ++doc_topics_count[new_topic];
+        ++words_topics_count_[v][new_topic];
+      }
+    }
+  }
+
+  // count topics of loaded documents
+  void InitDocsTopicsCount() {
+    docs_topics_count_.Init(M_, K_);
+    for (int m = 0; m < M_; m++) {
+      auto& doc_topics_count = docs_topics_count_[m];
+      doc_topics_count.Reserve(docs_[m + 1] - docs_[m]);
+      for (int i = docs_[m], end = docs_[m + 1]; i < end; i++) {
+        ++doc_topics_count[topics_[i]];
+      }
+    }
+  }
+
+  // Save the model as text files "prefix"-meta, "prefix"-topic-count and
+  // "prefix"-word-topic-count.
   bool SaveModel(const std::string& prefix) const {
     INFO("Saving model.");
     return SaveMeta(prefix + "-meta") &&
@@ -90,6 +225,99 @@ class Model : public Corpus {
            SaveWordTopicCount(prefix + "-word-topic-count");
   }
 
+  // Save the model as a binary file, see "model_file.h".
+  bool SaveBinaryModel(const std::string& filename) const {
+    INFO("Saving binary model.");
+    std::ofstream ofs(filename.c_str(), std::ios::binary);
+    if (!ofs.is_open()) {
+      ERROR("Failed to open \"%s\".", filename.c_str());
+      return false;
+    }
+
+    // original word ids
+    std::vector<int> rows(V_);  // id -> row
+    for (int v = 0; v < V_; v++) {
+      rows[word_ids_.empty() ? v : word_ids_[v]] = v;
+    }
+
+    std::vector<int64_t> row_offsets(V_ + 1);
+    for (int id = 0; id < V_; id++) {
+      const TableType& table = words_topics_count_[rows[id]];
+      int64_t size = 0;
+      for (auto first = table.begin(), last = table.end(); first != last;
+           ++first) {
+        size++;
+      }
+      row_offsets[id + 1] = row_offsets[id] + size;
+    }
+
+    ModelFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kModelFileMagic, sizeof(header.magic));
+    header.version = kModelFileVersion;
+    header.V = V_;
+    header.K = K_;
+    header.M = model_docs();
+    header.nnz = row_offsets[V_];
+    header.beta = hp_beta_;
+
+    std::vector<int32_t> topics_count(K_ + (K_ & 1));
+    for (int k = 0; k < K_; k++) {
+      topics_count[k] = topics_count_[k];
+    }
+
+    // the header is rewritten with the hash of the data after it
+    ModelFileHasher hasher;
+    auto write = [&ofs, &hasher](const void* data, size_t size) {
+      hasher.Update(data, size);
+      ofs.write(static_cast<const char*>(data), size);
+    };
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    write(&hp_alpha_[0], sizeof(double) * K_);
+    write(&row_offsets[0], sizeof(int64_t) * (V_ + 1));
+    write(&topics_count[0], sizeof(int32_t) * topics_count.size());
+
+    // write entries through a large buffer
+    const size_t kBufferEntries = 1 << 20;
+    std::vector<ModelFileEntry> buffer;
+    buffer.reserve(kBufferEntries);
+    std::vector<ModelFileEntry> row;
+    for (int id = 0; id < V_; id++) {
+      const TableType& table = words_topics_count_[rows[id]];
+      row.clear();
+      for (auto first = table.begin(), last = table.end(); first != last;
+           ++first) {
+        ModelFileEntry entry;
+        entry.k = first.id();
+        entry.count = first.count();
+        row.push_back(entry);
+      }
+      std::sort(row.begin(), row.end(),
+                [](const ModelFileEntry& a, const ModelFileEntry& b) {
+                  return a.k < b.k;
+                });
+      for (const ModelFileEntry& entry : row) {
+        if (buffer.size() == kBufferEntries) {
+          write(&buffer[0], sizeof(ModelFileEntry) * buffer.size());
+          buffer.clear();
+        }
+        buffer.push_back(entry);
+      }
+    }
+    if (!buffer.empty()) {
+      write(&buffer[0], sizeof(ModelFileEntry) * buffer.size());
+    }
+    header.content_hash = hasher.hash();
+    ofs.seekp(0);
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    if (!ofs) {
+      ERROR("Failed to write \"%s\".", filename.c_str());
+      return false;
+    }
+    return true;
+  }
+
  private:
   bool SaveMeta(const std::string& filename) const {
     std::ofstream ofs(filename.c_str());
@@ -98,13 +326,13 @@ class Model : public Corpus {
       return false;
     }
 
-    ofs << "M=" << M_ << std::endl;
-    ofs << "V=" << V_ << std::endl;
-    ofs << "K=" << K_ << std::endl;
+    ofs << "M=" << model_docs() << '\n';
+    ofs << "V=" << V_ << '\n';
+    ofs << "K=" << K_ << '\n';
     for (int k = 0; k < K_; k++) {
-      ofs << "a=" << hp_alpha_[k] << std::endl;
+      ofs << "a=" << hp_alpha_[k] << '\n';
     }
-    ofs << "b=" << hp_beta_ << std::endl;
+    ofs << "b=" << hp_beta_ << '\n';
     return true;
   }
 
@@ -113,7 +341,8 @@ class Model : public Corpus {
   }
 
   bool SaveWordTopicCount(const std::string& filename) const {
-    return words_topics_count_.Save(filename);
+    // original word ids
+    return words_topics_count_.Save(filename, word_ids_);
   }
 };
 
@@ -0,0 +1,108 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "model_file.h"
+#include <string.h>
+#include "x.h"
+
+const char kModelFileMagic[8] = {'L', 'D', 'A', 'M', 'O', 'D', 'E', 'L'};
+const int kModelFileVersion = 2;
+
+int64_t ModelFileSize(int V, int K, int64_t nnz) {
+  return static_cast<int64_t>(sizeof(ModelFileHeader)) +
+         static_cast<int64_t>(sizeof(double)) * K +
+         static_cast<int64_t>(sizeof(int64_t)) * (V + 1) +
+         static_cast<int64_t>(sizeof(int32_t)) * (K + (K & 1)) +
+         static_cast<int64_t>(sizeof(ModelFileEntry)) * nnz;
+}
+
+void ModelFileHasher::Update(const void* data, size_t size) {
+  DCHECK(size % 8 == 0);
+  const char* p = static_cast<const char*>(data);
+  for (size_t i = 0; i < size; i += 8) {
+    uint64_t word;
+    memcpy(&word, p + i, sizeof(word));
+    // FNV-1a on 64 bits words, with high bits folded down
+    hash_ = (hash_ ^ word) * 0x100000001b3ULL;
+    hash_ ^= hash_ >> 32;
+  }
+}
+
+ModelFile::ModelFile()
+    : alpha_(nullptr),
+      rows_(nullptr),
+      topics_count_(nullptr),
+      entries_(nullptr) {
+  memset(&header_, 0, sizeof(header_));
+}
+
+bool ModelFile::Open(const std::string& filename) {
+  Close();
+  if (!file_.Open(filename)) {
+    return false;
+  }
+
+  if (file_.size() < sizeof(header_)) {
+    ERROR("\"%s\" is too small.", filename.c_str());
+    Close();
+    return false;
+  }
+  memcpy(&header_, file_.data(), sizeof(header_));
+  if (memcmp(header_.magic, kModelFileMagic, sizeof(header_.magic)) != 0) {
+    ERROR("\"%s\" is not a binary model.", filename.c_str());
+    Close();
+    return false;
+  }
+  if (header_.version != kModelFileVersion) {
+    ERROR("\"%s\" has version %d, but %d is required.", filename.c_str(),
+          header_.version, kModelFileVersion);
+    Close();
+    return false;
+  }
+  if (header_.V <= 0 || header_.K <= 0 || header_.nnz < 0 ||
+      static_cast<int64_t>(file_.size()) !=
+          ModelFileSize(header_.V, header_.K, header_.nnz)) {
+    ERROR("\"%s\" has a bad header or size.", filename.c_str());
+    Close();
+    return false;
+  }
+
+  const char* p = file_.data() + sizeof(header_);
+  alpha_ = reinterpret_cast<const double*>(p);
+  p += sizeof(double) * header_.K;
+  rows_ = reinterpret_cast<const int64_t*>(p);
+  p += sizeof(int64_t) * (header_.V + 1);
+  topics_count_ = reinterpret_cast<const int32_t*>(p);
+  p += sizeof(int32_t) * (header_.K + (header_.K & 1));
+  entries_ = reinterpret_cast<const ModelFileEntry*>(p);
+
+  if (rows_[0] != 0 || rows_[header_.V] != header_.nnz) {
+    ERROR("\"%s\" has bad row indices.", filename.c_str());
+    Close();
+    return false;
+  }
+  for (int v = 0; v < header_.V; v++) {
+    if (rows_[v] > rows_[v + 1]) {
+      ERROR("\"%s\" has bad row indices.", filename.c_str());
+      Close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void ModelFile::Close() {
+  file_.Close();
+  memset(&header_, 0, sizeof(header_));
+  alpha_ = nullptr;
+  rows_ = nullptr;
+  topics_count_ = nullptr;
+  entries_ = nullptr;
+}
+
+uint64_t ModelFile::Digest() const {
+  ModelFileHasher hasher;
+  hasher.Update(&header_, sizeof(header_));
+  return hasher.hash();
+}
@@ -0,0 +1,94 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// binary LDA model file
+//
+
+#ifndef MODEL_FILE_H_
+#define MODEL_FILE_H_
+
+#include <stdint.h>
+#include <string>
+#include "mapped_file.h"
+
+// binary model layout, in native byte order:
+// ModelFileHeader,
+// double alpha[K],
+// int64 rows[V + 1], starting indices of words in "entries",
+// int32 topics_count[K], int32 padding if K is odd,
+// ModelFileEntry entries[nnz], word-topic counts of words in CSR form,
+// sorted by topic id in each word.
+struct ModelFileHeader {
+  char magic[8];
+  int32_t version;
+  int32_t V;
+  int32_t K;
+  int32_t reserved;
+  int64_t M;    // # of training docs
+  int64_t nnz;  // # of non-zero word-topic counts
+  double beta;
+  uint64_t content_hash;  // "ModelFileHasher" of all data after the header
+};
+
+struct ModelFileEntry {
+  int32_t k;
+  int32_t count;
+};
+
+extern const char kModelFileMagic[8];
+extern const int kModelFileVersion;
+
+// Return the size of a model file with these dimensions.
+int64_t ModelFileSize(int V, int K, int64_t nnz);
+
+// incremental hash of model file data, 8 bytes a step,
+// all parts of a model file are multiples of 8 bytes
+class ModelFileHasher {
+ private:
+  uint64_t hash_;
+
+ public:
+  ModelFileHasher() : hash_(0xcbf29ce484222325ULL) {}
+
+  // "size" is a multiple of 8.
+  void Update(const void* data, size_t size);
+  uint64_t hash() const { return hash_; }
+};
+
+// read-only mapped binary model
+class ModelFile {
+ private:
+  MappedFile file_;
+  ModelFileHeader header_;
+  const double* alpha_;
+  const int64_t* rows_;
+  const int32_t* topics_count_;
+  const ModelFileEntry* entries_;
+
+ public:
+  ModelFile();
+
+  bool Open(const std::string& filename);
+  void Close();
+
+  int V() const { return header_.V; }
+  int K() const { return header_.K; }
+  int64_t M() const { return header_.M; }
+  int64_t nnz() const { return header_.nnz; }
+  double beta() const { return header_.beta; }
+  const double* alpha() const { return alpha_; }
+  const int32_t* topics_count() const { return topics_count_; }
+  // word-topic counts of word "v" are [row_begin(v), row_end(v))
+  const ModelFileEntry* row_begin(int v) const { return entries_ + rows_[v]; }
+  const ModelFileEntry* row_end(int v) const {
+    return entries_ + rows_[v + 1];
+  }
+  int64_t row_offset(int v) const { return rows_[v]; }
+
+  // Return a digest of the header, which holds a hash of all the data
+  // computed when it is written, so it identifies the model without
+  // reading its entries.
+  uint64_t Digest() const;
+};
+
+#endif  // MODEL_FILE_H_
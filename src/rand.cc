@@ -5,5 +5,25 @@
 //
 
 #include "rand.h"
+#include <sstream>
 
 std::random_device Random::device_;
+
+std::string Random::GetState() const {
+  std::ostringstream oss;
+  oss << engine_;
+  return oss.str();
+}
+
+bool Random::SetState(const std::string& state) {
+  std::istringstream iss(state);
+  std::mt19937 engine;
+  iss >> engine;
+  if (iss.fail()) {
+    return false;
+  }
+  engine_ = engine;
+  float_dist_.reset();
+  int_dist_.reset();
+  return true;
+}
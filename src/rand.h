@@ -9,6 +9,7 @@
 
 #include <limits>
 #include <random>
+#include <string>
 
 class Random {
  private:
@@ -31,6 +32,10 @@ class Random {
   int GetNext(Int K) {
     return static_cast<int>(int_dist_(engine_) % K);
   }
+
+  // engine state saved in checkpoints
+  std::string GetState() const;
+  bool SetState(const std::string& state);
 };
 
 #endif  // RAND_H_
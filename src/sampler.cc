@@ -4,86 +4,100 @@
 
 #include "sampler.h"
 #include <random>
+#include "dense_kernel.h"
 
-// u is in [0, 1)
-static int SampleCDF(const std::vector<double>& cdf, double u) {
-  int size = static_cast<int>(cdf.size());
-  const double sample = u * cdf[size - 1];
-  if (size < 128) {
-    // brute force search
-    int i;
-    for (i = 0; i < size; i++) {
-      if (cdf[i] >= sample) {
-        break;
-      }
-    }
-    return i;
-  } else {
-    // binary search
-    int count = size, half_count;
-    int first = 0, middle;
-    while (count > 0) {
-      half_count = count >> 1;
-      middle = first + half_count;
-      if (sample <= cdf[middle]) {
-        count = half_count;
-      } else {
-        first = middle + 1;
-        count -= (half_count + 1);
-      }
-    }
-    return first;
-  }
+/************************************************************************/
+/* GibbsSampler */
+/************************************************************************/
+template <class Topic>
+void GibbsSamplerT<Topic>::Init() {
+  BaseType::Init();
+  InitWorker();
+  INFO("Gibbs sampling kernels use %s.", DenseKernelISA());
 }
 
-static inline int SampleCDF(const std::vector<double>& cdf, Random* gen) {
-  return SampleCDF(cdf, gen->GetNext());
+template <class Topic>
+Sampler<HybridHashTables, Topic>* GibbsSamplerT<Topic>::NewWorker() const {
+  return new GibbsSamplerT();
 }
 
-/************************************************************************/
-/* GibbsSampler */
-/************************************************************************/
-void GibbsSampler::Init() {
-  Sampler::Init();
+template <class Topic>
+void GibbsSamplerT<Topic>::InitWorker() {
   word_topic_cdf_.resize(K_);
+  topics_denom_.resize(K_);
+  doc_alpha_.resize(K_);
+  word_beta_.resize(K_);
 }
 
-void GibbsSampler::SampleDocument(Word* word, int doc_length,
-                                  TableType* doc_topics_count) {
-  for (int n = 0; n < doc_length; n++, word++) {
-    const int v = word->v;
-    const int old_k = word->k;
-    auto& word_topics_count = words_topics_count_[v];
-    int k, new_k;
-
-    --topics_count_[old_k];
-    --word_topics_count[old_k];
-    --(*doc_topics_count)[old_k];
-
-    word_topic_cdf_[0] = 0.0;
-    for (k = 0; k < K_ - 1; k++) {
-      word_topic_cdf_[k] += (word_topics_count[k] + hp_beta_) /
-                            (topics_count_[k] + hp_sum_beta_) *
-                            ((*doc_topics_count)[k] + hp_alpha_[k]);
-      word_topic_cdf_[k + 1] = word_topic_cdf_[k];
+template <class Topic>
+void GibbsSamplerT<Topic>::SampleDocument(const int* words, TopicType* topics,
+                                          int doc_length,
+                                          DocTableType* doc_topics_count) {
+  // The posterior (N_vk + beta) / (N_k + sum_beta) * (N_mk + alpha_k)
+  // is a product of three dense factors, which are gathered once,
+  // and updated for changed topics only.
+  for (int k = 0; k < K_; k++) {
+    topics_denom_[k] = 1.0 / (topics_count_[k] + hp_sum_beta_);
+    doc_alpha_[k] = hp_alpha_[k];
+  }
+  for (auto first = doc_topics_count->begin(), last = doc_topics_count->end();
+       first != last; ++first) {
+    doc_alpha_[first.id()] += first.count();
+  }
+
+  // repeated words share the row
+  int row_v = -1;
+  TableType* row = nullptr;
+  for (int n = 0; n < doc_length; n++) {
+    const int v = words[n];
+    if (!InWordSlice(v)) {
+      continue;
+    }
+    const int old_k = topics[n];
+    if (v != row_v) {
+      row = &words_topics_count_[v];
+      row_v = v;
+      row->GetCounts(hp_beta_, &word_beta_[0]);
     }
-    word_topic_cdf_[k] += (word_topics_count[k] + hp_beta_) /
-                          (topics_count_[k] + hp_sum_beta_) *
-                          ((*doc_topics_count)[k] + hp_alpha_[k]);
-
-    new_k = SampleCDF(word_topic_cdf_, &random_);
-    ++topics_count_[new_k];
-    ++word_topics_count[new_k];
-    ++(*doc_topics_count)[new_k];
-    word->k = new_k;
+    auto& word_topics_count = *row;
+
+    topics_denom_[old_k] = 1.0 / (--topics_count_[old_k] + hp_sum_beta_);
+    word_beta_[old_k] = --word_topics_count[old_k] + hp_beta_;
+    doc_alpha_[old_k] = --(*doc_topics_count)[old_k] + hp_alpha_[old_k];
+
+    const double sum = DenseCDF(&word_beta_[0], &topics_denom_[0],
+                                &doc_alpha_[0], K_, &word_topic_cdf_[0]);
+    const int new_k =
+        SearchCDF(&word_topic_cdf_[0], K_, random_.GetNext() * sum);
+
+    topics_denom_[new_k] = 1.0 / (++topics_count_[new_k] + hp_sum_beta_);
+    word_beta_[new_k] = ++word_topics_count[new_k] + hp_beta_;
+    doc_alpha_[new_k] = ++(*doc_topics_count)[new_k] + hp_alpha_[new_k];
+    topics[n] = static_cast<TopicType>(new_k);
   }
 }
 
 /************************************************************************/
 /* SparseLDASampler */
 /************************************************************************/
-void SparseLDASampler::Init() {
-  Sampler::Init();
+template <class Topic>
+void SparseLDASamplerT<Topic>::Init() {
+  BaseType::Init();
+  smooth_pdf_.resize(K_);
+  doc_pdf_.resize(K_);
+  word_pdf_.resize(K_);
+  cache_.resize(K_);
+  PrepareSmoothBucket();
+}
+
+template <class Topic>
+Sampler<CountSortedTables, Topic>* SparseLDASamplerT<Topic>::NewWorker()
+    const {
+  return new SparseLDASamplerT();
+}
+
+template <class Topic>
+void SparseLDASamplerT<Topic>::InitWorker() {
   smooth_pdf_.resize(K_);
   doc_pdf_.resize(K_);
   word_pdf_.resize(K_);
@@ -91,46 +105,70 @@ void SparseLDASampler::Init() {
   PrepareSmoothBucket();
 }
 
-void SparseLDASampler::PostSampleCorpus() {
-  Sampler::PostSampleCorpus();
+template <class Topic>
+void SparseLDASamplerT<Topic>::PostSampleCorpus() {
+  BaseType::PostSampleCorpus();
   if (HPOpt_Enabled()) {
     PrepareSmoothBucket();
   }
 }
 
-void SparseLDASampler::PostSampleDocument(int m) {
-  const auto& doc_topics_count = docs_topics_count_[m];
-  auto first = doc_topics_count.begin();
-  auto last = doc_topics_count.end();
+template <class Topic>
+void SparseLDASamplerT<Topic>::SampleDocument(const int* words,
+                                              TopicType* topics,
+                                              int doc_length,
+                                              DocTableType* doc_topics_count) {
+  PrepareDocBucket(*doc_topics_count);
+  // "word_pdf_" holds the word bucket of "bucket_v",
+  // it is updated in place instead of rebuilt for repeated words.
+  int bucket_v = -1;
+  TableType* word_topics_count = nullptr;
+  for (int n = 0; n < doc_length; n++) {
+    const int v = words[n];
+    if (!InWordSlice(v)) {
+      continue;
+    }
+    const int old_k = topics[n];
+    if (v != bucket_v) {
+      word_topics_count = &words_topics_count_[v];
+    }
+    const int old_count =
+        RemoveOrAddWordTopic(doc_topics_count, word_topics_count, old_k, 1);
+    if (v != bucket_v) {
+      PrepareWordBucket(*word_topics_count);
+      bucket_v = v;
+    } else {
+      UpdateWordBucket(old_k, old_count);
+    }
+    const int new_k = SampleDocumentWord(*doc_topics_count, *word_topics_count);
+    const int new_count =
+        RemoveOrAddWordTopic(doc_topics_count, word_topics_count, new_k, 0);
+    if (n + 1 < doc_length && words[n + 1] == v) {
+      UpdateWordBucket(new_k, new_count);
+    } else {
+      bucket_v = -1;
+    }
+    topics[n] = static_cast<TopicType>(new_k);
+  }
+
+  // restore "cache_" for the next document
+  auto first = doc_topics_count->begin();
+  auto last = doc_topics_count->end();
   for (; first != last; ++first) {
     const int k = first.id();
     cache_[k] = hp_alpha_[k] / (topics_count_[k] + hp_sum_beta_);
   }
-  Sampler::HPOpt_PostSampleDocument(m);
 }
 
-void SparseLDASampler::SampleDocument(int m) {
-  PrepareDocBucket(m);
-  const int N = docs_[m + 1] - docs_[m];
-  Word* word = &words_[docs_[m]];
-  for (int n = 0; n < N; n++, word++) {
-    const int v = word->v;
-    const int old_k = word->k;
-    RemoveOrAddWordTopic(m, v, old_k, 1);
-    PrepareWordBucket(v);
-    const int new_k = SampleDocumentWord(m, v);
-    RemoveOrAddWordTopic(m, v, new_k, 0);
-    word->k = new_k;
-  }
-}
-
-void SparseLDASampler::RemoveOrAddWordTopic(int m, int v, int k, int remove) {
-  auto& doc_topics_count = docs_topics_count_[m];
-  auto& word_topics_count = words_topics_count_[v];
+template <class Topic>
+int SparseLDASamplerT<Topic>::RemoveOrAddWordTopic(
+    DocTableType* doc_topics_count, TableType* word_topics_count, int k,
+    int remove) {
   double& smooth_bucket_k = smooth_pdf_[k];
   double& doc_bucket_k = doc_pdf_[k];
   const double hp_alpha_k = hp_alpha_[k];
   int doc_topic_count;
+  int word_topic_count;
   int topic_count;
 
   smooth_sum_ -= smooth_bucket_k;
@@ -138,12 +176,12 @@ void SparseLDASampler::RemoveOrAddWordTopic(int m, int v, int k, int remove) {
 
   if (remove) {
     topic_count = --topics_count_[k];
-    --word_topics_count[k];
-    doc_topic_count = --doc_topics_count[k];
+    word_topic_count = --(*word_topics_count)[k];
+    doc_topic_count = --(*doc_topics_count)[k];
   } else {
     topic_count = ++topics_count_[k];
-    ++word_topics_count[k];
-    doc_topic_count = ++doc_topics_count[k];
+    word_topic_count = ++(*word_topics_count)[k];
+    doc_topic_count = ++(*doc_topics_count)[k];
   }
 
   smooth_bucket_k = hp_alpha_k * hp_beta_ / (topic_count + hp_sum_beta_);
@@ -151,39 +189,41 @@ void SparseLDASampler::RemoveOrAddWordTopic(int m, int v, int k, int remove) {
   smooth_sum_ += smooth_bucket_k;
   doc_sum_ += doc_bucket_k;
   cache_[k] = (doc_topic_count + hp_alpha_k) / (topic_count + hp_sum_beta_);
+  return word_topic_count;
 }
 
-int SparseLDASampler::SampleDocumentWord(int m, int v) {
+template <class Topic>
+int SparseLDASamplerT<Topic>::SampleDocumentWord(
+    const DocTableType& doc_topics_count,
+    const TableType& word_topics_count) {
   const double sum = smooth_sum_ + doc_sum_ + word_sum_;
   double sample = random_.GetNext() * sum;
   int new_k = -1;
 
   if (sample < word_sum_) {
-    const auto& word_topics_count = words_topics_count_[v];
     auto first = word_topics_count.begin();
     auto last = word_topics_count.end();
     for (; first != last; ++first) {
-      const int k = first.id();
-      sample -= word_pdf_[k];
+      // the last entry if rounding exhausts the loop
+      new_k = first.id();
+      sample -= word_pdf_[new_k];
       if (sample <= 0.0) {
         break;
       }
     }
-    new_k = first.id();
   } else {
     sample -= word_sum_;
     if (sample < doc_sum_) {
-      const auto& doc_topics_count = docs_topics_count_[m];
       auto first = doc_topics_count.begin();
       auto last = doc_topics_count.end();
       for (; first != last; ++first) {
-        const int k = first.id();
-        sample -= doc_pdf_[k];
+        // the last entry if rounding exhausts the loop
+        new_k = first.id();
+        sample -= doc_pdf_[new_k];
         if (sample <= 0.0) {
           break;
         }
       }
-      new_k = first.id();
     } else {
       sample -= doc_sum_;
       int k;
@@ -193,14 +233,15 @@ int SparseLDASampler::SampleDocumentWord(int m, int v) {
           break;
         }
       }
-      new_k = k;
+      new_k = std::min(k, K_ - 1);
     }
   }
 
   return new_k;
 }
 
-void SparseLDASampler::PrepareSmoothBucket() {
+template <class Topic>
+void SparseLDASamplerT<Topic>::PrepareSmoothBucket() {
   smooth_sum_ = 0.0;
   for (int k = 0; k < K_; k++) {
     const double tmp = hp_alpha_[k] / (topics_count_[k] + hp_sum_beta_);
@@ -211,10 +252,11 @@ void SparseLDASampler::PrepareSmoothBucket() {
   }
 }
 
-void SparseLDASampler::PrepareDocBucket(int m) {
+template <class Topic>
+void SparseLDASamplerT<Topic>::PrepareDocBucket(
+    const DocTableType& doc_topics_count) {
   doc_sum_ = 0.0;
   doc_pdf_.assign(K_, 0);
-  const auto& doc_topics_count = docs_topics_count_[m];
   auto first = doc_topics_count.begin();
   auto last = doc_topics_count.end();
   for (; first != last; ++first) {
@@ -227,10 +269,11 @@ void SparseLDASampler::PrepareDocBucket(int m) {
   }
 }
 
-void SparseLDASampler::PrepareWordBucket(int v) {
+template <class Topic>
+void SparseLDASamplerT<Topic>::PrepareWordBucket(
+    const TableType& word_topics_count) {
   word_sum_ = 0.0;
   word_pdf_.assign(K_, 0);
-  const auto& word_topics_count = words_topics_count_[v];
   auto first = word_topics_count.begin();
   auto last = word_topics_count.end();
   for (; first != last; ++first) {
@@ -241,19 +284,46 @@ void SparseLDASampler::PrepareWordBucket(int v) {
   }
 }
 
+template <class Topic>
+void SparseLDASamplerT<Topic>::UpdateWordBucket(int k, int word_topic_count) {
+  double& pdf = word_pdf_[k];
+  word_sum_ -= pdf;
+  pdf = word_topic_count * cache_[k];
+  word_sum_ += pdf;
+}
+
 /************************************************************************/
 /* AliasLDASampler */
 /************************************************************************/
-void AliasLDASampler::Init() {
-  Sampler::Init();
+template <class Topic>
+void AliasLDASamplerT<Topic>::Init() {
+  BaseType::Init();
+  p_pdf_.resize(K_);
+  q_sums_.resize(V_);
+  q_samples_.resize(V_);
+  q_pdf_.resize(K_);
+}
+
+template <class Topic>
+Sampler<HybridHashTables, Topic>* AliasLDASamplerT<Topic>::NewWorker() const {
+  AliasLDASamplerT* worker = new AliasLDASamplerT();
+  worker->mh_step_ = mh_step_;
+  return worker;
+}
+
+template <class Topic>
+void AliasLDASamplerT<Topic>::InitWorker() {
   p_pdf_.resize(K_);
   q_sums_.resize(V_);
   q_samples_.resize(V_);
   q_pdf_.resize(K_);
 }
 
-void AliasLDASampler::SampleDocument(Word* word, int doc_length,
-                                     TableType* doc_topics_count) {
+template <class Topic>
+void AliasLDASamplerT<Topic>::SampleDocument(const int* words,
+                                             TopicType* topics,
+                                             int doc_length,
+                                             DocTableType* doc_topics_count) {
   int s, t;
 // Macro SMOLA_ALIAS_LDA implements the pure algorithm from
 // Alex Smola's paper. Otherwise,
@@ -269,11 +339,21 @@ void AliasLDASampler::SampleDocument(Word* word, int doc_length,
   double temp_s, temp_t;
   double p_sum, q_sum;
   double sample;
-
-  for (int n = 0; n < doc_length; n++, word++) {
-    const int v = word->v;
-    auto& word_topics_count = words_topics_count_[v];
-    const int old_k = word->k;
+  // repeated words share the row
+  int row_v = -1;
+  TableType* row = nullptr;
+
+  for (int n = 0; n < doc_length; n++) {
+    const int v = words[n];
+    if (!InWordSlice(v)) {
+      continue;
+    }
+    if (v != row_v) {
+      row = &words_topics_count_[v];
+      row_v = v;
+    }
+    auto& word_topics_count = *row;
+    const int old_k = topics[n];
     s = old_k;
 
     N_s_prime = --topics_count_[s];
@@ -393,7 +473,7 @@ void AliasLDASampler::SampleDocument(Word* word, int doc_length,
 #endif
         DCHECK(accept_rate >= 0.0);
         if (random_.GetNext() < accept_rate) {
-          word->k = t;
+          topics[n] = static_cast<TopicType>(t);
           s = t;
 #if defined SMOLA_ALIAS_LDA
           N_s = N_t;
@@ -418,16 +498,36 @@ void AliasLDASampler::SampleDocument(Word* word, int doc_length,
 /************************************************************************/
 /* LightLDASampler */
 /************************************************************************/
-void LightLDASampler::Init() {
-  Sampler::Init();
+template <class Tables, class Topic>
+void LightLDASamplerT<Tables, Topic>::Init() {
+  BaseType::Init();
+  std::vector<double> hp_alpha = hp_alpha_;
+  hp_alpha_alias_table_.Build(&hp_alpha_alias_, &hp_alpha, hp_sum_alpha_);
+  word_topics_pdf_.resize(K_);
+  words_topic_samples_.resize(V_);
+}
+
+template <class Tables, class Topic>
+Sampler<Tables, Topic, HybridHashTables>*
+LightLDASamplerT<Tables, Topic>::NewWorker() const {
+  LightLDASamplerT* worker = new LightLDASamplerT();
+  worker->mh_step_ = mh_step_;
+  worker->enable_word_proposal_ = enable_word_proposal_;
+  worker->enable_doc_proposal_ = enable_doc_proposal_;
+  return worker;
+}
+
+template <class Tables, class Topic>
+void LightLDASamplerT<Tables, Topic>::InitWorker() {
   std::vector<double> hp_alpha = hp_alpha_;
   hp_alpha_alias_table_.Build(&hp_alpha_alias_, &hp_alpha, hp_sum_alpha_);
   word_topics_pdf_.resize(K_);
   words_topic_samples_.resize(V_);
 }
 
-void LightLDASampler::PostSampleCorpus() {
-  Sampler::PostSampleCorpus();
+template <class Tables, class Topic>
+void LightLDASamplerT<Tables, Topic>::PostSampleCorpus() {
+  BaseType::PostSampleCorpus();
   if (HPOpt_Enabled()) {
     if (hp_opt_alpha_iteration_ > 0) {
       std::vector<double> hp_alpha = hp_alpha_;
@@ -436,20 +536,33 @@ void LightLDASampler::PostSampleCorpus() {
   }
 }
 
-void LightLDASampler::SampleDocument(Word* word, int doc_length,
-                                     TableType* doc_topics_count) {
+template <class Tables, class Topic>
+void LightLDASamplerT<Tables, Topic>::SampleDocument(
+    const int* words, TopicType* topics, int doc_length,
+    DocTableType* doc_topics_count) {
   int s, t;
   int N_s, N_vs, N_ms, N_t, N_vt, N_mt;
   int N_s_prime, N_vs_prime, N_ms_prime;
   int N_t_prime, N_vt_prime, N_mt_prime;
   double hp_alpha_s, hp_alpha_t;
   double accept_rate;
-  Word* word0 = word;
-
-  for (int n = 0; n < doc_length; n++, word++) {
-    const int v = word->v;
-    auto& word_topics_count = words_topics_count_[v];
-    const int old_k = word->k;
+  // repeated words share the row and the word proposal
+  int row_v = -1;
+  TableType* row = nullptr;
+  std::vector<int>* word_topic_samples = nullptr;
+
+  for (int n = 0; n < doc_length; n++) {
+    const int v = words[n];
+    if (!InWordSlice(v)) {
+      continue;
+    }
+    if (v != row_v) {
+      row = &words_topics_count_[v];
+      word_topic_samples = &words_topic_samples_[v];
+      row_v = v;
+    }
+    auto& word_topics_count = *row;
+    const int old_k = topics[n];
     s = old_k;
 
     N_s_prime = N_s = topics_count_[s];
@@ -465,7 +578,7 @@ void LightLDASampler::SampleDocument(Word* word, int doc_length,
     for (int step = 0; step < mh_step_; step++) {
       if (enable_word_proposal_) {
         // sample new topic from word proposal
-        t = SampleWithWord(v);
+        t = SampleWithWord(word_topics_count, word_topic_samples);
 
         if (s != t) {
           // calculate accept rate from topic s to topic t:
@@ -499,7 +612,7 @@ void LightLDASampler::SampleDocument(Word* word, int doc_length,
 
           DCHECK(accept_rate >= 0.0);
           if (random_.GetNext() < accept_rate) {
-            word->k = t;
+            topics[n] = static_cast<TopicType>(t);
             s = t;
             N_s = N_t;
             N_vs = N_vt;
@@ -513,7 +626,7 @@ void LightLDASampler::SampleDocument(Word* word, int doc_length,
       }
 
       if (enable_doc_proposal_) {
-        t = SampleWithDoc(word0, doc_length, v);
+        t = SampleWithDoc(topics, doc_length, v);
         if (s != t) {
           // calculate accept rate from topic s to topic t:
           // (N^{'}_{mt} + \alpha_t)(N^{'}_{vt} + \beta)
@@ -545,7 +658,7 @@ void LightLDASampler::SampleDocument(Word* word, int doc_length,
 
           DCHECK(accept_rate >= 0.0);
           if (random_.GetNext() < accept_rate) {
-            word->k = t;
+            topics[n] = static_cast<TopicType>(t);
             s = t;
             N_s = N_t;
             N_vs = N_vt;
@@ -570,12 +683,14 @@ void LightLDASampler::SampleDocument(Word* word, int doc_length,
   }
 }
 
-int LightLDASampler::SampleWithWord(int v) {
+template <class Tables, class Topic>
+int LightLDASamplerT<Tables, Topic>::SampleWithWord(
+    const TableType& word_topics_count,
+    std::vector<int>* word_topic_samples) {
   // word proposal: (N_vk + beta)/(N_k + sum_beta)
-  auto& word_v_topic_samples = words_topic_samples_[v];
+  auto& word_v_topic_samples = *word_topic_samples;
   if (word_v_topic_samples.empty()) {
     double sum = 0.0;
-    const auto& word_topics_count = words_topics_count_[v];
     word_topics_pdf_.assign(K_, 0.0);
     auto first = word_topics_count.begin();
     auto last = word_topics_count.end();
@@ -607,7 +722,9 @@ int LightLDASampler::SampleWithWord(int v) {
   return new_k;
 }
 
-int LightLDASampler::SampleWithDoc(Word* word, int doc_length, int v) {
+template <class Tables, class Topic>
+int LightLDASamplerT<Tables, Topic>::SampleWithDoc(const TopicType* topics,
+                                                   int doc_length, int v) {
   // doc proposal: N_mk + alpha_k
   double sample = random_.GetNext() * (hp_sum_alpha_ + doc_length);
   if (sample < hp_sum_alpha_) {
@@ -618,6 +735,17 @@ int LightLDASampler::SampleWithDoc(Word* word, int doc_length, int v) {
       // rare numerical errors may lie in this branch
       index--;
     }
-    return word[index].k;
+    return topics[index];
   }
 }
+
+template class GibbsSamplerT<uint16_t>;
+template class GibbsSamplerT<int>;
+template class SparseLDASamplerT<uint16_t>;
+template class SparseLDASamplerT<int>;
+template class AliasLDASamplerT<uint16_t>;
+template class AliasLDASamplerT<int>;
+template class LightLDASamplerT<HybridHashTables, uint16_t>;
+template class LightLDASamplerT<HybridHashTables, int>;
+template class LightLDASamplerT<ConcurrentHashTables, uint16_t>;
+template class LightLDASamplerT<ConcurrentHashTables, int>;
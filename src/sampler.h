@@ -8,23 +8,39 @@
 #define SAMPLER_H_
 
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <limits>
 #include <string>
+#include <utility>
 #include <vector>
 #include "alias.h"
+#include "checkpoint.h"
+#include "concurrent_table.h"
 #include "model.h"
+#include "scheduler.h"
+#include "shm_sync.h"
 #include "table.h"
 #include "x.h"
 
+#if defined _OPENMP
+#include <omp.h>
+#endif
+
 /************************************************************************/
 /* Sampler */
 /************************************************************************/
-template <class Tables>
-class Sampler : public Model<Tables> {
+template <class Tables, class Topic, class DocTables = Tables>
+class Sampler : public Model<Tables, Topic, DocTables> {
  protected:
-  typedef Model<Tables> BaseType;
+  typedef Model<Tables, Topic, DocTables> BaseType;
   using BaseType::docs_;
-  using BaseType::words_;
+  using BaseType::topics_;
   using BaseType::M_;
+  using BaseType::N_;
   using BaseType::V_;
   using BaseType::K_;
   using BaseType::topics_count_;
@@ -35,6 +51,7 @@ class Sampler : public Model<Tables> {
   using BaseType::hp_beta_;
   using BaseType::hp_sum_beta_;
   using BaseType::random_;
+  using BaseType::restored_;
   using BaseType::Init;
 
   // hyper parameters optimizations
@@ -63,9 +80,71 @@ class Sampler : public Model<Tables> {
   int log_likelihood_interval_;
   int iteration_;
 
+  // document parallel sampling(AD-LDA):
+  // each worker samples a range of documents against its own copy of
+  // "topics_count_" and a shadow of "words_topics_count_",
+  // whose deltas are merged at the end of each iteration.
+  //
+  // model parallel sampling(F+Nomad LDA):
+  // the vocabulary is also split into slices. In sub-epoch "r",
+  // worker "t" samples words in slice "(t + r) % threads" of its documents,
+  // so each row of "words_topics_count_" has exactly one writer.
+  // Only "topics_count_" is merged after each sub-epoch.
+  //
+  // Hogwild sampling:
+  // like document parallel sampling, but workers update
+  // "words_topics_count_" in place, which requires concurrent tables.
+  int threads_;
+  int model_parallel_;
+  int hogwild_;
+  std::vector<Sampler*> workers_;
+  Scheduler scheduler_;
+  mutable Scheduler llh_scheduler_;
+  // word_slices_[s]: the first word of vocabulary slice "s"
+  std::vector<int> word_slices_;
+  // words in [word_begin_, word_end_) are sampled
+  int word_begin_;
+  int word_end_;
+
+  // multi-process sampling:
+  // each process samples its own part of documents and keeps replicas of
+  // word-topic counts. After each iteration, processes push their count
+  // deltas to shared memory, where global topic counts live,
+  // and apply deltas of the others.
+  int process_id_;
+  int processes_;
+  std::string shm_name_;
+  ShmSync shm_;
+  // old_topics_[i]: topic of word "i" pushed last time, -1 if none
+  std::vector<int> old_topics_;
+  long long total_words_;  // of all processes
+
+  // words of the document being sampled in a run length corpus
+  std::vector<int> doc_words_;
+
+  // checkpoints:
+  // topics, hyper parameters, "iteration_" and random states are saved
+  // every "checkpoint_interval_" iterations, and restored if "resume_".
+  int checkpoint_interval_;
+  int resume_;
+  std::string checkpoint_filename_;
+  CheckpointWriter checkpoint_writer_;
+  // restored random states of workers
+  std::vector<std::string> worker_random_states_;
+
+  // called after each iteration with "iteration_",
+  // training stops if it returns false
+  std::function<bool(int)> iteration_callback_;
+
+  // "Train" has been called, it may only be called once
+  bool trained_;
+
  public:
   typedef Tables TablesType;
   typedef typename TablesType::TableType TableType;
+  typedef DocTables DocTablesType;
+  typedef typename DocTablesType::TableType DocTableType;
+  typedef Topic TopicType;
 
   Sampler()
       : hp_opt_(0),
@@ -77,7 +156,24 @@ class Sampler : public Model<Tables> {
         total_iteration_(0),
         burnin_iteration_(0),
         log_likelihood_interval_(0),
-        iteration_(0) {}
+        iteration_(0),
+        threads_(1),
+        model_parallel_(0),
+        hogwild_(0),
+        word_begin_(0),
+        word_end_(std::numeric_limits<int>::max()),
+        process_id_(0),
+        processes_(1),
+        total_words_(0),
+        checkpoint_interval_(0),
+        resume_(0),
+        trained_(false) {}
+
+  virtual ~Sampler() {
+    for (Sampler* worker : workers_) {
+      delete worker;
+    }
+  }
 
   int& hp_opt() { return hp_opt_; }
   int& hp_opt_interval() { return hp_opt_interval_; }
@@ -88,17 +184,54 @@ class Sampler : public Model<Tables> {
   int& total_iteration() { return total_iteration_; }
   int& burnin_iteration() { return burnin_iteration_; }
   int& log_likelihood_interval() { return log_likelihood_interval_; }
+  int& threads() { return threads_; }
+  int& model_parallel() { return model_parallel_; }
+  int& hogwild() { return hogwild_; }
+  int& process_id() { return process_id_; }
+  int& processes() { return processes_; }
+  std::string& shm_name() { return shm_name_; }
+  int& checkpoint_interval() { return checkpoint_interval_; }
+  int& resume() { return resume_; }
+  std::string& checkpoint_filename() { return checkpoint_filename_; }
+  std::function<bool(int)>& iteration_callback() {
+    return iteration_callback_;
+  }
+  bool trained() const { return trained_; }
 
   virtual double LogLikelihood() const;
+  double CorpusLogLikelihood();
   virtual void Train();
   virtual void PreSampleCorpus();
   virtual void PostSampleCorpus();
   virtual void SampleCorpus();
+  void SampleBlock();
   virtual void PreSampleDocument(int m);
   virtual void PostSampleDocument(int m);
   virtual void SampleDocument(int m);
-  virtual void SampleDocument(Word* word, int doc_length,
-                              TableType* doc_topics_count);
+  // sample words[0, doc_length) of a document,
+  // whose topics are topics[0, doc_length)
+  virtual void SampleDocument(const int* words, TopicType* topics,
+                              int doc_length,
+                              DocTableType* doc_topics_count);
+  // create a worker with the same sampler options
+  virtual Sampler* NewWorker() const { return nullptr; }
+  // called on a worker at the beginning of each iteration,
+  // after counts and hyper parameters are synchronized
+  virtual void InitWorker() {}
+  void InitProcesses();
+  void SyncProcesses();
+  double ReduceLogLikelihood(double llh);
+  void SaveCheckpoint();
+  bool LoadCheckpoint();
+  // kCheckpoint* flags of the corpus
+  int CheckpointLayout() const;
+  void InitWorkers();
+  void InitSchedulers();
+  void SyncWorker(Sampler* worker);
+  void MergeTopicsCount();
+  void MergeWordsTopicsCount();
+  void SampleCorpusDocParallel();
+  void SampleCorpusModelParallel();
   void HPOpt_Init();
   void HPOpt_Optimize();
   void HPOpt_OptimizeAlpha();
@@ -113,66 +246,158 @@ class Sampler : public Model<Tables> {
     }
     return false;
   }
+
+  bool InWordSlice(int v) const { return v >= word_begin_ && v < word_end_; }
 };
 
-template <class Tables>
-double Sampler<Tables>::LogLikelihood() const {
+template <class Tables, class Topic, class DocTables>
+double Sampler<Tables, Topic, DocTables>::LogLikelihood() const {
+  std::vector<double> sums(llh_scheduler_.threads(), 0.0);
+  llh_scheduler_.Run(
+      [this, &sums](int t, int m_begin, int m_end) {
+        double sum = 0.0;
+        std::vector<int> buffer;
+        for (int m = m_begin; m < m_end; m++) {
+          const int N = docs_[m + 1] - docs_[m];
+          const int* word = this->DocWords(m, &buffer);
+          const auto& doc_topics_count = docs_topics_count_[m];
+          // the likelihood of a word depends on the word and the doc only,
+          // it is computed once for repeated words
+          int last_v = -1;
+          double log_word_sum = 0.0;
+          for (int n = 0; n < N; n++, word++) {
+            const int v = *word;
+            if (v != last_v) {
+              const auto& word_topics_count = words_topics_count_[v];
+              double word_sum = 0.0;
+              for (int k = 0; k < K_; k++) {
+                const double phi_kv = (word_topics_count[k] + hp_beta_) /
+                                      (topics_count_[k] + hp_sum_beta_);
+                word_sum += (doc_topics_count[k] + hp_alpha_[k]) * phi_kv;
+              }
+              word_sum /= (N + hp_sum_alpha_);
+              log_word_sum = log(word_sum);
+              last_v = v;
+            }
+            sum += log_word_sum;
+          }
+        }
+        sums[t] += sum;
+      },
+      true);
+  llh_scheduler_.Report("LogLikelihood");
+
   double sum = 0.0;
-#if defined _OPENMP
-#pragma omp parallel for schedule(static) reduction(+ : sum)
-#endif
-  for (int m = 0; m < M_; m++) {
-    const int N = docs_[m + 1] - docs_[m];
-    const Word* word = &words_[docs_[m]];
-    const auto& doc_topics_count = docs_topics_count_[m];
-    for (int n = 0; n < N; n++, word++) {
-      const int v = word->v;
-      const auto& word_topics_count = words_topics_count_[v];
-      double word_sum = 0.0;
-      for (int k = 0; k < K_; k++) {
-        const double phi_kv = (word_topics_count[k] + hp_beta_) /
-                              (topics_count_[k] + hp_sum_beta_);
-        word_sum += (doc_topics_count[k] + hp_alpha_[k]) * phi_kv;
-      }
-      word_sum /= (N + hp_sum_alpha_);
-      sum += log(word_sum);
-    }
+  for (double s : sums) {
+    sum += s;
+  }
+  return sum;
+}
+
+template <class Tables, class Topic, class DocTables>
+double Sampler<Tables, Topic, DocTables>::CorpusLogLikelihood() {
+  if (!this->streaming()) {
+    return LogLikelihood();
+  }
+
+  double sum = 0.0;
+  this->BeginBlocks(false);
+  while (this->NextBlock()) {
+    this->InitDocsTopicsCount();
+    llh_scheduler_.Init(&docs_[0], M_, llh_scheduler_.threads());
+    sum += LogLikelihood();
   }
   return sum;
 }
 
-template <class Tables>
-void Sampler<Tables>::Train() {
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::Train() {
+  CHECK(!trained_);
+  trained_ = true;
   INFO("Training begins.");
+  InitProcesses();
+  int begin_iteration = 1;
+  if (resume_) {
+    CHECK(LoadCheckpoint());
+    begin_iteration = iteration_ + 1;
+  }
   Init();
-  for (iteration_ = 1; iteration_ <= total_iteration_; iteration_++) {
+  InitWorkers();
+  InitSchedulers();
+  SyncProcesses();
+  for (iteration_ = begin_iteration; iteration_ <= total_iteration_;
+       iteration_++) {
     INFO("Iteration %d begins.", iteration_);
     PreSampleCorpus();
     SampleCorpus();
+    SyncProcesses();
     PostSampleCorpus();
 
-    if ((iteration_ > burnin_iteration_) &&
+    if ((iteration_ > burnin_iteration_) && (log_likelihood_interval_ > 0) &&
         (iteration_ % log_likelihood_interval_ == 0)) {
       INFO("Calculating LogLikelihood.");
-      const double llh = LogLikelihood();
-      INFO("LogLikelihood(total/word)=%lg/%lg.", llh, llh / words_.size());
+      const double llh = ReduceLogLikelihood(CorpusLogLikelihood());
+      INFO("LogLikelihood(total/word)=%lg/%lg.", llh, llh / total_words_);
+    }
+
+    if (checkpoint_interval_ > 0 && iteration_ % checkpoint_interval_ == 0) {
+      SaveCheckpoint();
+    }
+
+    if (iteration_callback_ && !iteration_callback_(iteration_)) {
+      INFO("Training is stopped by the callback.");
+      break;
     }
   }
+  checkpoint_writer_.Wait();
   INFO("Training ended.");
 }
 
-template <class Tables>
-void Sampler<Tables>::PreSampleCorpus() {
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::PreSampleCorpus() {
   HPOpt_Init();
 }
 
-template <class Tables>
-void Sampler<Tables>::PostSampleCorpus() {
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::PostSampleCorpus() {
   HPOpt_Optimize();
 }
 
-template <class Tables>
-void Sampler<Tables>::SampleCorpus() {
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::SampleCorpus() {
+  if (!this->streaming()) {
+    SampleBlock();
+    return;
+  }
+
+  this->BeginBlocks(true);
+  while (this->NextBlock()) {
+    this->InitDocsTopicsCount();
+    if (!workers_.empty()) {
+      scheduler_.Init(&docs_[0], M_, threads_);
+    }
+    SampleBlock();
+  }
+}
+
+// sample loaded documents
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::SampleBlock() {
+  if (!workers_.empty()) {
+    if (model_parallel_) {
+      SampleCorpusModelParallel();
+    } else {
+      SampleCorpusDocParallel();
+    }
+
+    if (HPOpt_Enabled()) {
+      for (int m = 0; m < M_; m++) {
+        HPOpt_PostSampleDocument(m);
+      }
+    }
+    return;
+  }
+
   for (int m = 0; m < M_; m++) {
     PreSampleDocument(m);
     SampleDocument(m);
@@ -180,28 +405,505 @@ void Sampler<Tables>::SampleCorpus() {
   }
 }
 
-template <class Tables>
-void Sampler<Tables>::PreSampleDocument(int m) {}
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::PreSampleDocument(int m) {}
 
-template <class Tables>
-void Sampler<Tables>::PostSampleDocument(int m) {
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::PostSampleDocument(int m) {
   HPOpt_PostSampleDocument(m);
 }
 
-template <class Tables>
-void Sampler<Tables>::SampleDocument(int m) {
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::SampleDocument(int m) {
   const int N = docs_[m + 1] - docs_[m];
-  Word* word = &words_[docs_[m]];
   auto& doc_topics_count = docs_topics_count_[m];
-  SampleDocument(word, N, &doc_topics_count);
+  SampleDocument(this->DocWords(m, &doc_words_), &topics_[docs_[m]], N,
+                 &doc_topics_count);
+}
+
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::SampleDocument(
+    const int* words, TopicType* topics, int doc_length,
+    DocTableType* doc_topics_count) {}
+
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::InitProcesses() {
+  total_words_ = this->total_words();
+  if (processes_ <= 1) {
+    return;
+  }
+
+  // the smart prior must be the same in all processes
+  if (hp_sum_alpha_ <= 0) {
+    hp_sum_alpha_ = total_words_ * 1.0 / M_ / K_;
+  }
+
+  std::vector<int> boundaries;
+  this->PartitionDocs(processes_, &boundaries);
+  // at most 2 deltas for each word
+  std::vector<int> capacities(processes_);
+  for (int p = 0; p < processes_; p++) {
+    const long long words =
+        docs_[boundaries[p + 1]] - docs_[boundaries[p]];
+    CHECK(words * 2 <= std::numeric_limits<int>::max());
+    capacities[p] = static_cast<int>(words * 2);
+  }
+
+  CHECK(shm_.Open(shm_name_, process_id_, processes_, V_, K_, capacities));
+  this->all_docs_ = M_;
+  this->KeepDocs(boundaries[process_id_], boundaries[process_id_ + 1]);
+  old_topics_.assign(N_, -1);
 }
 
-template <class Tables>
-void Sampler<Tables>::SampleDocument(Word* word, int doc_length,
-                                     TableType* doc_topics_count) {}
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::SyncProcesses() {
+  if (processes_ <= 1) {
+    return;
+  }
 
-template <class Tables>
-void Sampler<Tables>::HPOpt_Init() {
+  // collect own deltas
+  std::vector<CountDelta> deltas;
+  for (int m = 0; m < M_; m++) {
+    const int* words = this->DocWords(m, &doc_words_);
+    for (int i = docs_[m], end = docs_[m + 1]; i < end; i++) {
+      const int v = *words++;
+      const int k = topics_[i];
+      int& old_k = old_topics_[i];
+      if (old_k == k) {
+        continue;
+      }
+      if (old_k != -1) {
+        CountDelta delta = {v, old_k, -1};
+        deltas.push_back(delta);
+      }
+      CountDelta delta = {v, k, 1};
+      deltas.push_back(delta);
+      old_k = k;
+    }
+  }
+
+  std::sort(deltas.begin(), deltas.end(),
+            [](const CountDelta& a, const CountDelta& b) {
+              return a.v < b.v || (a.v == b.v && a.k < b.k);
+            });
+
+  // push merged deltas
+  CountDelta* shm_deltas = shm_.deltas(process_id_);
+  std::vector<int> topics_delta(K_);
+  int size = 0;
+  for (size_t i = 0; i < deltas.size();) {
+    CountDelta delta = deltas[i];
+    for (i++; i < deltas.size() && deltas[i].v == delta.v &&
+              deltas[i].k == delta.k;
+         i++) {
+      delta.count += deltas[i].count;
+    }
+    if (delta.count != 0) {
+      shm_deltas[size++] = delta;
+      topics_delta[delta.k] += delta.count;
+    }
+  }
+  DCHECK(size <= shm_.capacity(process_id_));
+  shm_.delta_size(process_id_) = size;
+  for (int k = 0; k < K_; k++) {
+    if (topics_delta[k] != 0) {
+      shm_.topics_count()[k].fetch_add(topics_delta[k]);
+    }
+  }
+  CHECK(shm_.Barrier());
+
+  // pull deltas of others
+  for (int p = 0; p < processes_; p++) {
+    if (p == process_id_) {
+      continue;
+    }
+    const CountDelta* first = shm_.deltas(p);
+    const CountDelta* last = first + shm_.delta_size(p);
+    for (; first != last; ++first) {
+      auto&& count = words_topics_count_[first->v][first->k];
+      if (first->count > 0) {
+        count += first->count;
+      } else {
+        count -= -first->count;
+      }
+    }
+  }
+  for (int k = 0; k < K_; k++) {
+    const int delta = shm_.topics_count()[k].load() - topics_count_[k];
+    if (delta != 0) {
+      topics_count_[k] += delta;
+    }
+  }
+  // deltas have been read by all processes
+  CHECK(shm_.Barrier());
+}
+
+template <class Tables, class Topic, class DocTables>
+double Sampler<Tables, Topic, DocTables>::ReduceLogLikelihood(double llh) {
+  if (processes_ <= 1) {
+    return llh;
+  }
+
+  shm_.llh(process_id_) = llh;
+  CHECK(shm_.Barrier());
+  double sum = 0.0;
+  for (int p = 0; p < processes_; p++) {
+    sum += shm_.llh(p);
+  }
+  CHECK(shm_.Barrier());
+  return sum;
+}
+
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::SaveCheckpoint() {
+  std::vector<std::string> random_states;
+  random_states.push_back(random_.GetState());
+  for (const Sampler* worker : workers_) {
+    random_states.push_back(worker->random_.GetState());
+  }
+
+  CheckpointHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kCheckpointMagic, sizeof(header.magic));
+  header.version = kCheckpointVersion;
+  header.topic_size = sizeof(TopicType);
+  header.M = M_;
+  header.V = V_;
+  header.K = K_;
+  header.iteration = iteration_;
+  header.N = N_;
+  header.hp_sum_alpha = hp_sum_alpha_;
+  header.hp_beta = hp_beta_;
+  header.rngs = static_cast<int32_t>(random_states.size());
+  header.layout = CheckpointLayout();
+
+  size_t size = sizeof(header) + sizeof(double) * K_ +
+                sizeof(TopicType) * static_cast<size_t>(N_);
+  for (const std::string& state : random_states) {
+    size += sizeof(int32_t) + state.size();
+  }
+
+  // a frozen copy of the state, sampling goes on while it is written
+  std::vector<char> data(size);
+  char* p = &data[0];
+  auto append = [&p](const void* src, size_t n) {
+    if (n) {
+      memcpy(p, src, n);
+      p += n;
+    }
+  };
+  append(&header, sizeof(header));
+  append(&hp_alpha_[0], sizeof(double) * K_);
+  for (const std::string& state : random_states) {
+    const int32_t state_size = static_cast<int32_t>(state.size());
+    append(&state_size, sizeof(state_size));
+    append(state.data(), state.size());
+  }
+  append(topics_.data(), sizeof(TopicType) * static_cast<size_t>(N_));
+  checkpoint_writer_.Write(checkpoint_filename_, std::move(data));
+}
+
+template <class Tables, class Topic, class DocTables>
+int Sampler<Tables, Topic, DocTables>::CheckpointLayout() const {
+  int layout = 0;
+  if (this->run_length()) {
+    layout |= kCheckpointRunLength;
+  }
+  if (!this->word_ids().empty()) {
+    layout |= kCheckpointRemapWords;
+  }
+  if (this->grouped()) {
+    layout |= kCheckpointGroupWords;
+  }
+  return layout;
+}
+
+template <class Tables, class Topic, class DocTables>
+bool Sampler<Tables, Topic, DocTables>::LoadCheckpoint() {
+  const char* filename = checkpoint_filename_.c_str();
+  std::ifstream ifs(filename, std::ios::binary);
+  if (!ifs.is_open()) {
+    ERROR("Failed to open \"%s\".", filename);
+    return false;
+  }
+
+  CheckpointHeader header;
+  if (!ifs.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+      memcmp(header.magic, kCheckpointMagic, sizeof(header.magic)) != 0 ||
+      header.version != kCheckpointVersion) {
+    ERROR("\"%s\" is not a checkpoint of version %d.", filename,
+          kCheckpointVersion);
+    return false;
+  }
+  if (header.topic_size != static_cast<int>(sizeof(TopicType)) ||
+      header.M != M_ || header.V != V_ || header.K != K_ ||
+      header.N != N_ || header.rngs < 1) {
+    ERROR("\"%s\" does not match the corpus or K.", filename);
+    return false;
+  }
+  if (header.layout != CheckpointLayout()) {
+    ERROR("\"%s\" does not match run_length, remap_words or group_words.",
+          filename);
+    return false;
+  }
+
+  hp_alpha_.resize(K_);
+  ifs.read(reinterpret_cast<char*>(&hp_alpha_[0]), sizeof(double) * K_);
+  std::vector<std::string> random_states(header.rngs);
+  for (std::string& state : random_states) {
+    int32_t state_size = 0;
+    ifs.read(reinterpret_cast<char*>(&state_size), sizeof(state_size));
+    if (!ifs || state_size < 0) {
+      break;
+    }
+    state.resize(state_size);
+    ifs.read(&state[0], state_size);
+  }
+  topics_.resize(N_);
+  ifs.read(reinterpret_cast<char*>(topics_.data()),
+           sizeof(TopicType) * static_cast<size_t>(N_));
+  if (!ifs) {
+    ERROR("\"%s\" is truncated.", filename);
+    return false;
+  }
+
+  for (int i = 0; i < N_; i++) {
+    if (static_cast<int>(topics_[i]) < 0 ||
+        static_cast<int>(topics_[i]) >= K_) {
+      ERROR("\"%s\" has bad topics.", filename);
+      return false;
+    }
+  }
+  if (!random_.SetState(random_states[0])) {
+    ERROR("\"%s\" has bad random states.", filename);
+    return false;
+  }
+  worker_random_states_.assign(random_states.begin() + 1,
+                               random_states.end());
+
+  hp_sum_alpha_ = header.hp_sum_alpha;
+  hp_beta_ = header.hp_beta;
+  iteration_ = header.iteration;
+  restored_ = true;
+  INFO("Resuming after iteration %d.", iteration_);
+  return true;
+}
+
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::InitWorkers() {
+  if (threads_ <= 1) {
+    return;
+  }
+
+  INFO("Initializing %d workers.", threads_);
+  for (int t = 0; t < threads_; t++) {
+    Sampler* worker = NewWorker();
+    CHECK(worker);
+    worker->V_ = V_;
+    worker->K_ = K_;
+    if (model_parallel_ || hogwild_) {
+      worker->words_topics_count_.InitView(&words_topics_count_);
+    } else {
+      worker->words_topics_count_.InitShadow(&words_topics_count_);
+    }
+    workers_.push_back(worker);
+  }
+
+  // a different number of threads starts workers with new random states
+  if (worker_random_states_.size() == workers_.size()) {
+    for (int t = 0; t < threads_; t++) {
+      CHECK(workers_[t]->random_.SetState(worker_random_states_[t]));
+    }
+  }
+  worker_random_states_.clear();
+
+  if (model_parallel_) {
+    // vocabulary slices with balanced word frequencies
+    std::vector<int> word_freq;
+    this->WordFrequency(&word_freq);
+
+    const long long total = N_;
+    long long sum = 0;
+    int s = 1;
+    word_slices_.assign(threads_ + 1, V_);
+    word_slices_[0] = 0;
+    for (int v = 0; v < V_; v++) {
+      sum += word_freq[v];
+      while (s < threads_ && sum * threads_ >= total * s) {
+        word_slices_[s++] = v + 1;
+      }
+    }
+  }
+}
+
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::InitSchedulers() {
+  int llh_threads = threads_;
+#if defined _OPENMP
+  if (llh_threads <= 1) {
+    llh_threads = omp_get_max_threads();
+  }
+#endif
+  if (this->streaming()) {
+    // initialized again for each block
+    const int no_docs[1] = {0};
+    llh_scheduler_.Init(no_docs, 0, llh_threads);
+    return;
+  }
+  llh_scheduler_.Init(&docs_[0], M_, llh_threads);
+  if (!workers_.empty()) {
+    scheduler_.Init(&docs_[0], M_, threads_);
+  }
+}
+
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::SyncWorker(Sampler* worker) {
+  worker->topics_count_ = topics_count_;
+  worker->words_topics_count_.ClearShadow();
+  worker->hp_alpha_ = hp_alpha_;
+  worker->hp_sum_alpha_ = hp_sum_alpha_;
+  worker->hp_beta_ = hp_beta_;
+  worker->hp_sum_beta_ = hp_sum_beta_;
+  worker->iteration_ = iteration_;
+  worker->InitWorker();
+}
+
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::MergeTopicsCount() {
+  for (int k = 0; k < K_; k++) {
+    const int count = topics_count_[k];
+    int delta = 0;
+    for (const Sampler* worker : workers_) {
+      delta += worker->topics_count_[k] - count;
+    }
+    if (delta != 0) {
+      topics_count_[k] += delta;
+    }
+  }
+}
+
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::MergeWordsTopicsCount() {
+  const int threads = static_cast<int>(workers_.size());
+
+  // deltas[t][b]: deltas of worker "t" for words "v" that v % threads == b
+  struct Delta {
+    int v;
+    int k;
+    int count;
+  };
+  std::vector<std::vector<std::vector<Delta> > > deltas(threads);
+
+  // all deltas are collected before "words_topics_count_" is modified
+#if defined _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(threads)
+#endif
+  for (int t = 0; t < threads; t++) {
+    const auto& local_words_topics_count = workers_[t]->words_topics_count_;
+    const auto& global_words_topics_count = words_topics_count_;
+    auto& worker_deltas = deltas[t];
+    worker_deltas.resize(threads);
+    for (int v : local_words_topics_count.shadow_rows()) {
+      const auto& local = local_words_topics_count[v];
+      const auto& global = global_words_topics_count[v];
+      auto& bucket = worker_deltas[v % threads];
+      for (auto first = local.begin(), last = local.end(); first != last;
+           ++first) {
+        const int k = first.id();
+        const int count = first.count() - global[k];
+        if (count != 0) {
+          Delta delta = {v, k, count};
+          bucket.push_back(delta);
+        }
+      }
+      for (auto first = global.begin(), last = global.end(); first != last;
+           ++first) {
+        const int k = first.id();
+        if (local[k] == 0) {
+          Delta delta = {v, k, -first.count()};
+          bucket.push_back(delta);
+        }
+      }
+    }
+  }
+
+#if defined _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(threads)
+#endif
+  for (int b = 0; b < threads; b++) {
+    for (int t = 0; t < threads; t++) {
+      for (const Delta& delta : deltas[t][b]) {
+        auto&& count = words_topics_count_[delta.v][delta.k];
+        if (delta.count > 0) {
+          count += delta.count;
+        } else {
+          count -= -delta.count;
+        }
+      }
+    }
+  }
+}
+
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::SampleCorpusDocParallel() {
+  for (Sampler* worker : workers_) {
+    SyncWorker(worker);
+  }
+
+  scheduler_.Run(
+      [this](int t, int m_begin, int m_end) {
+        Sampler* worker = workers_[t];
+        for (int m = m_begin; m < m_end; m++) {
+          const int N = docs_[m + 1] - docs_[m];
+          auto& doc_topics_count = docs_topics_count_[m];
+          worker->SampleDocument(this->DocWords(m, &worker->doc_words_),
+                                 &topics_[docs_[m]], N, &doc_topics_count);
+        }
+      },
+      true);
+  scheduler_.Report("Sampling");
+
+  MergeTopicsCount();
+  if (hogwild_) {
+    // all workers are quiescent now
+    ReclaimRetiredStorage(&words_topics_count_);
+  } else {
+    MergeWordsTopicsCount();
+  }
+}
+
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::SampleCorpusModelParallel() {
+  const int threads = static_cast<int>(workers_.size());
+  for (int r = 0; r < threads; r++) {
+    for (Sampler* worker : workers_) {
+      SyncWorker(worker);
+    }
+
+    // documents of a thread are not stolen,
+    // as words of a slice must be sampled by one thread
+    scheduler_.Run(
+        [this, threads, r](int t, int m_begin, int m_end) {
+          Sampler* worker = workers_[t];
+          const int slice = (t + r) % threads;
+          worker->word_begin_ = word_slices_[slice];
+          worker->word_end_ = word_slices_[slice + 1];
+          for (int m = m_begin; m < m_end; m++) {
+            const int N = docs_[m + 1] - docs_[m];
+            auto& doc_topics_count = docs_topics_count_[m];
+            worker->SampleDocument(this->DocWords(m, &worker->doc_words_),
+                                   &topics_[docs_[m]], N, &doc_topics_count);
+          }
+        },
+        false);
+
+    MergeTopicsCount();
+  }
+  scheduler_.Report("Sampling");
+}
+
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::HPOpt_Init() {
   if (!HPOpt_Enabled()) {
     return;
   }
@@ -214,8 +916,8 @@ void Sampler<Tables>::HPOpt_Init() {
   hp_opt_topic_len_hist_a.clear();
 }
 
-template <class Tables>
-void Sampler<Tables>::HPOpt_Optimize() {
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::HPOpt_Optimize() {
   if (!HPOpt_Enabled()) {
     return;
   }
@@ -231,8 +933,8 @@ void Sampler<Tables>::HPOpt_Optimize() {
   }
 }
 
-template <class Tables>
-void Sampler<Tables>::HPOpt_OptimizeAlpha() {
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::HPOpt_OptimizeAlpha() {
   for (int i = 0; i < hp_opt_alpha_iteration_; i++) {
     double denom = 0;
     double diff_digamma = 0;
@@ -264,8 +966,8 @@ void Sampler<Tables>::HPOpt_OptimizeAlpha() {
   }
 }
 
-template <class Tables>
-void Sampler<Tables>::HPOpt_PrepareOptimizeBeta() {
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::HPOpt_PrepareOptimizeBeta() {
   for (int m = 0; m < M_; m++) {
     const auto& doc_topics_count = docs_topics_count_[m];
     for (int k = 0; k < K_; k++) {
@@ -292,8 +994,8 @@ void Sampler<Tables>::HPOpt_PrepareOptimizeBeta() {
   }
 }
 
-template <class Tables>
-void Sampler<Tables>::HPOpt_OptimizeBeta() {
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::HPOpt_OptimizeBeta() {
   for (int i = 0; i < hp_opt_beta_iteration_; i++) {
     double num = 0;
     double diff_digamma = 0;
@@ -316,8 +1018,8 @@ void Sampler<Tables>::HPOpt_OptimizeBeta() {
   }
 }
 
-template <class Tables>
-void Sampler<Tables>::HPOpt_PostSampleDocument(int m) {
+template <class Tables, class Topic, class DocTables>
+void Sampler<Tables, Topic, DocTables>::HPOpt_PostSampleDocument(int m) {
   if (!HPOpt_Enabled()) {
     return;
   }
@@ -349,21 +1051,59 @@ void Sampler<Tables>::HPOpt_PostSampleDocument(int m) {
 /************************************************************************/
 /* GibbsSampler */
 /************************************************************************/
-class GibbsSampler : public Sampler<HashTables> {
+template <class Topic>
+class GibbsSamplerT : public Sampler<HybridHashTables, Topic> {
+ protected:
+  typedef Sampler<HybridHashTables, Topic> BaseType;
+  typedef typename BaseType::TableType TableType;
+  typedef typename BaseType::DocTableType DocTableType;
+  typedef typename BaseType::TopicType TopicType;
+  using BaseType::K_;
+  using BaseType::topics_count_;
+  using BaseType::words_topics_count_;
+  using BaseType::hp_alpha_;
+  using BaseType::hp_beta_;
+  using BaseType::hp_sum_beta_;
+  using BaseType::random_;
+  using BaseType::InWordSlice;
+
  private:
-  std::vector<double> word_topic_cdf_;  // cached
+  // cached
+  std::vector<double> word_topic_cdf_;
+  std::vector<double> topics_denom_;  // 1 / (N_k + sum_beta)
+  std::vector<double> doc_alpha_;     // N_mk + alpha_k
+  std::vector<double> word_beta_;     // N_vk + beta
 
  public:
-  GibbsSampler() {}
+  GibbsSamplerT() {}
   virtual void Init() override;
-  virtual void SampleDocument(Word* word, int doc_length,
-                              TableType* doc_topics_count) override;
+  virtual BaseType* NewWorker() const override;
+  virtual void InitWorker() override;
+  virtual void SampleDocument(const int* words, TopicType* topics,
+                              int doc_length,
+                              DocTableType* doc_topics_count) override;
 };
 
 /************************************************************************/
 /* SparseLDASampler */
 /************************************************************************/
-class SparseLDASampler : public Sampler<SparseTables> {
+template <class Topic>
+class SparseLDASamplerT : public Sampler<CountSortedTables, Topic> {
+ protected:
+  typedef Sampler<CountSortedTables, Topic> BaseType;
+  typedef typename BaseType::TableType TableType;
+  typedef typename BaseType::DocTableType DocTableType;
+  typedef typename BaseType::TopicType TopicType;
+  using BaseType::K_;
+  using BaseType::topics_count_;
+  using BaseType::words_topics_count_;
+  using BaseType::hp_alpha_;
+  using BaseType::hp_beta_;
+  using BaseType::hp_sum_beta_;
+  using BaseType::random_;
+  using BaseType::HPOpt_Enabled;
+  using BaseType::InWordSlice;
+
  private:
   double smooth_sum_;
   double doc_sum_;
@@ -374,24 +1114,49 @@ class SparseLDASampler : public Sampler<SparseTables> {
   std::vector<double> cache_;
 
  public:
-  SparseLDASampler() {}
+  SparseLDASamplerT() {}
   virtual void Init() override;
+  virtual BaseType* NewWorker() const override;
+  virtual void InitWorker() override;
   virtual void PostSampleCorpus() override;
-  virtual void PostSampleDocument(int m) override;
-  virtual void SampleDocument(int m) override;
+  virtual void SampleDocument(const int* words, TopicType* topics,
+                              int doc_length,
+                              DocTableType* doc_topics_count) override;
 
  private:
-  void RemoveOrAddWordTopic(int m, int v, int k, int remove);
-  int SampleDocumentWord(int m, int v);
+  // return the new count of "k" in "word_topics_count"
+  int RemoveOrAddWordTopic(DocTableType* doc_topics_count,
+                           TableType* word_topics_count, int k, int remove);
+  int SampleDocumentWord(const DocTableType& doc_topics_count,
+                         const TableType& word_topics_count);
   void PrepareSmoothBucket();
-  void PrepareDocBucket(int m);
-  void PrepareWordBucket(int v);
+  void PrepareDocBucket(const DocTableType& doc_topics_count);
+  void PrepareWordBucket(const TableType& word_topics_count);
+  // update topic "k", whose count is "word_topic_count",
+  // of the prepared word bucket
+  void UpdateWordBucket(int k, int word_topic_count);
 };
 
 /************************************************************************/
 /* AliasLDASampler */
 /************************************************************************/
-class AliasLDASampler : public Sampler<HashTables> {
+template <class Topic>
+class AliasLDASamplerT : public Sampler<HybridHashTables, Topic> {
+ protected:
+  typedef Sampler<HybridHashTables, Topic> BaseType;
+  typedef typename BaseType::TableType TableType;
+  typedef typename BaseType::DocTableType DocTableType;
+  typedef typename BaseType::TopicType TopicType;
+  using BaseType::V_;
+  using BaseType::K_;
+  using BaseType::topics_count_;
+  using BaseType::words_topics_count_;
+  using BaseType::hp_alpha_;
+  using BaseType::hp_beta_;
+  using BaseType::hp_sum_beta_;
+  using BaseType::random_;
+  using BaseType::InWordSlice;
+
  private:
   std::vector<double> p_pdf_;
   std::vector<double> q_sums_;                // for each word v
@@ -402,17 +1167,41 @@ class AliasLDASampler : public Sampler<HashTables> {
   int mh_step_;
 
  public:
-  AliasLDASampler() : mh_step_(0) {}
+  AliasLDASamplerT() : mh_step_(0) {}
   int& mh_step() { return mh_step_; }
   virtual void Init() override;
-  virtual void SampleDocument(Word* word, int doc_length,
-                              TableType* doc_topics_count) override;
+  virtual BaseType* NewWorker() const override;
+  virtual void InitWorker() override;
+  virtual void SampleDocument(const int* words, TopicType* topics,
+                              int doc_length,
+                              DocTableType* doc_topics_count) override;
 };
 
 /************************************************************************/
 /* LightLDASampler */
 /************************************************************************/
-class LightLDASampler : public Sampler<HashTables> {
+// Doc-topic counts are always hybrid rows,
+// even if word-topic counts are concurrent rows for hogwild sampling.
+template <class Tables, class Topic>
+class LightLDASamplerT : public Sampler<Tables, Topic, HybridHashTables> {
+ protected:
+  typedef Sampler<Tables, Topic, HybridHashTables> BaseType;
+  typedef typename BaseType::TableType TableType;
+  typedef typename BaseType::DocTableType DocTableType;
+  typedef typename BaseType::TopicType TopicType;
+  using BaseType::V_;
+  using BaseType::K_;
+  using BaseType::topics_count_;
+  using BaseType::words_topics_count_;
+  using BaseType::hp_alpha_;
+  using BaseType::hp_sum_alpha_;
+  using BaseType::hp_beta_;
+  using BaseType::hp_sum_beta_;
+  using BaseType::random_;
+  using BaseType::hp_opt_alpha_iteration_;
+  using BaseType::HPOpt_Enabled;
+  using BaseType::InWordSlice;
+
  private:
   AliasBuilder hp_alpha_alias_table_;
   AliasD hp_alpha_alias_;
@@ -425,20 +1214,24 @@ class LightLDASampler : public Sampler<HashTables> {
   int enable_doc_proposal_;
 
  public:
-  LightLDASampler()
+  LightLDASamplerT()
       : mh_step_(0), enable_word_proposal_(1), enable_doc_proposal_(1) {}
   int& mh_step() { return mh_step_; }
   int& enable_word_proposal() { return enable_word_proposal_; }
   int& enable_doc_proposal() { return enable_doc_proposal_; }
 
   virtual void Init() override;
+  virtual BaseType* NewWorker() const override;
+  virtual void InitWorker() override;
   virtual void PostSampleCorpus() override;
-  virtual void SampleDocument(Word* word, int doc_length,
-                              TableType* doc_topics_count) override;
+  virtual void SampleDocument(const int* words, TopicType* topics,
+                              int doc_length,
+                              DocTableType* doc_topics_count) override;
 
  private:
-  int SampleWithWord(int v);
-  int SampleWithDoc(Word* word, int doc_length, int v);
+  int SampleWithWord(const TableType& word_topics_count,
+                     std::vector<int>* word_topic_samples);
+  int SampleWithDoc(const TopicType* topics, int doc_length, int v);
 };
 
 #endif  // SAMPLER_H_
@@ -0,0 +1,164 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// token balanced work stealing scheduler over documents
+//
+
+#ifndef SCHEDULER_H_
+#define SCHEDULER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include "x.h"
+
+// Documents are grouped into chunks with about the same number of tokens,
+// and each thread owns a contiguous range of chunks.
+// A thread that has finished its own chunks steals from the thread
+// with the most chunks left.
+class Scheduler {
+ private:
+  enum { kChunksPerThread = 16 };
+
+  struct Queue {
+    std::atomic<int> next;  // next chunk to claim
+    int end;
+    char padding[64];  // avoid false sharing
+  };
+
+  int threads_;
+  // chunks_[c]: the first document of chunk "c", a sentinel is at the end
+  std::vector<int> chunks_;
+  std::unique_ptr<Queue[]> queues_;
+  std::vector<int> queue_begins_;
+  std::vector<double> busy_;  // seconds
+  std::vector<double> idle_;  // seconds
+  std::vector<int> steals_;
+
+ public:
+  Scheduler() : threads_(0) {}
+
+  int threads() const { return threads_; }
+
+  // "docs" holds "M + 1" document starting indices like "Corpus::docs_"
+  void Init(const int* docs, int M, int threads) {
+    threads_ = threads;
+    const long long total = docs[M] - docs[0];
+    const int chunks = threads * kChunksPerThread;
+    chunks_.clear();
+    chunks_.push_back(0);
+    for (int c = 1; c < chunks; c++) {
+      const long long target = docs[0] + total * c / chunks;
+      const int m = static_cast<int>(std::lower_bound(docs, docs + M, target) -
+                                     docs);
+      if (m > chunks_.back()) {
+        chunks_.push_back(m);
+      }
+    }
+    if (M > chunks_.back()) {
+      chunks_.push_back(M);
+    }
+
+    const int size = static_cast<int>(chunks_.size()) - 1;
+    queues_.reset(new Queue[threads]);
+    queue_begins_.resize(threads);
+    for (int t = 0; t < threads; t++) {
+      queue_begins_[t] = static_cast<int>(1LL * size * t / threads);
+      queues_[t].end = static_cast<int>(1LL * size * (t + 1) / threads);
+    }
+    busy_.assign(threads, 0.0);
+    idle_.assign(threads, 0.0);
+    steals_.assign(threads, 0);
+  }
+
+  // Run "func(t, m_begin, m_end)" on all chunks with "threads()" threads.
+  // "steal" = false keeps each chunk on its owner thread.
+  template <class Func>
+  void Run(Func func, bool steal) {
+    typedef std::chrono::steady_clock Clock;
+    for (int t = 0; t < threads_; t++) {
+      queues_[t].next.store(queue_begins_[t], std::memory_order_relaxed);
+    }
+
+    const Clock::time_point start = Clock::now();
+#if defined _OPENMP
+#pragma omp parallel for schedule(static, 1) num_threads(threads_)
+#endif
+    for (int t = 0; t < threads_; t++) {
+      double busy = 0.0;
+      int chunk;
+      while ((chunk = Next(t, steal)) != -1) {
+        const Clock::time_point chunk_start = Clock::now();
+        func(t, chunks_[chunk], chunks_[chunk + 1]);
+        busy += std::chrono::duration<double>(Clock::now() - chunk_start)
+                    .count();
+      }
+      busy_[t] += busy;
+      idle_[t] -= busy;
+    }
+    const double wall =
+        std::chrono::duration<double>(Clock::now() - start).count();
+    for (int t = 0; t < threads_; t++) {
+      idle_[t] += wall;
+    }
+  }
+
+  // log busy/idle time and steals of each thread since the last "Report"
+  void Report(const char* name) {
+    std::string line;
+    char buf[64];
+    for (int t = 0; t < threads_; t++) {
+      snprintf(buf, sizeof(buf), " %d:%.0f/%.0f/%d", t, busy_[t] * 1000,
+               idle_[t] * 1000, steals_[t]);
+      line += buf;
+    }
+    INFO("%s thread:busy(ms)/idle(ms)/steals%s.", name, line.c_str());
+    busy_.assign(threads_, 0.0);
+    idle_.assign(threads_, 0.0);
+    steals_.assign(threads_, 0);
+  }
+
+ private:
+  // claim a chunk for thread "t", return -1 if there is none
+  int Next(int t, bool steal) {
+    Queue& own = queues_[t];
+    if (own.next.load(std::memory_order_relaxed) < own.end) {
+      const int chunk = own.next.fetch_add(1, std::memory_order_relaxed);
+      if (chunk < own.end) {
+        return chunk;
+      }
+    }
+
+    if (!steal) {
+      return -1;
+    }
+
+    for (;;) {
+      int victim = -1;
+      int victim_left = 0;
+      for (int i = 0; i < threads_; i++) {
+        const int left =
+            queues_[i].end - queues_[i].next.load(std::memory_order_relaxed);
+        if (left > victim_left) {
+          victim = i;
+          victim_left = left;
+        }
+      }
+      if (victim == -1) {
+        return -1;
+      }
+
+      Queue& queue = queues_[victim];
+      const int chunk = queue.next.fetch_add(1, std::memory_order_relaxed);
+      if (chunk < queue.end) {
+        steals_[t]++;
+        return chunk;
+      }
+    }
+  }
+};
+
+#endif  // SCHEDULER_H_
@@ -0,0 +1,276 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+
+#include "shm_sync.h"
+#include <stdint.h>
+#include <chrono>
+#include <new>
+#include "x.h"
+
+#if defined _WIN32
+#define SHM_SYNC_UNSUPPORTED
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+
+const uint64_t kMagic = 0x636e79536d68536cULL;
+const int kVersion = 2;
+// in milliseconds, for processes to create, attach to and initialize
+// the segment
+const int kOpenTimeout = 60000;
+
+size_t Align(size_t size) { return (size + 63) & ~static_cast<size_t>(63); }
+
+}  // namespace
+
+struct ShmSync::Header {
+  std::atomic<uint64_t> magic;
+  int version;
+  int processes;
+  int V;
+  int K;
+  std::atomic<int> barrier_count;
+  std::atomic<int> barrier_generation;
+  std::atomic<int> failed;
+};
+
+ShmSync::ShmSync()
+    : process_id_(0),
+      processes_(1),
+      addr_(nullptr),
+      size_(0),
+      header_(nullptr),
+      pids_(nullptr),
+      llhs_(nullptr),
+      topics_count_(nullptr),
+      delta_sizes_(nullptr) {}
+
+ShmSync::~ShmSync() { Close(); }
+
+#if defined SHM_SYNC_UNSUPPORTED
+bool ShmSync::Open(const std::string& name, int process_id, int processes,
+                   int V, int K, const std::vector<int>& capacities) {
+  ERROR("Shared memory is not supported on this platform.");
+  return false;
+}
+
+void ShmSync::Close() {}
+
+bool ShmSync::Barrier(int timeout) { return false; }
+
+bool ShmSync::Alive() const { return false; }
+
+void ShmSync::Fail() {}
+#else
+bool ShmSync::Open(const std::string& name, int process_id, int processes,
+                   int V, int K, const std::vector<int>& capacities) {
+  name_ = name[0] == '/' ? name : "/" + name;
+  process_id_ = process_id;
+  processes_ = processes;
+  capacities_ = capacities;
+
+  // layout
+  const size_t header_offset = 0;
+  const size_t pids_offset = header_offset + Align(sizeof(Header));
+  const size_t llhs_offset =
+      pids_offset + Align(sizeof(std::atomic<int>) * processes);
+  const size_t topics_count_offset =
+      llhs_offset + Align(sizeof(double) * processes);
+  const size_t delta_sizes_offset =
+      topics_count_offset + Align(sizeof(std::atomic<int>) * K);
+  size_t deltas_offset = delta_sizes_offset + Align(sizeof(int) * processes);
+  std::vector<size_t> deltas_offsets(processes);
+  for (int p = 0; p < processes; p++) {
+    deltas_offsets[p] = deltas_offset;
+    deltas_offset += Align(sizeof(CountDelta) * capacities[p]);
+  }
+  size_ = deltas_offset;
+
+  int fd;
+  if (process_id == 0) {
+    shm_unlink(name_.c_str());
+    fd = shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+      ERROR("Failed to create shared memory \"%s\".", name_.c_str());
+      return false;
+    }
+    if (ftruncate(fd, static_cast<off_t>(size_)) == -1) {
+      ERROR("Failed to resize shared memory \"%s\" to %zu bytes.",
+            name_.c_str(), size_);
+      close(fd);
+      shm_unlink(name_.c_str());
+      return false;
+    }
+  } else {
+    // wait for process 0
+    for (int i = 0;; i++) {
+      fd = shm_open(name_.c_str(), O_RDWR, 0600);
+      if (fd != -1) {
+        struct stat st;
+        if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= size_) {
+          break;
+        }
+        close(fd);
+      }
+      if (i == kOpenTimeout / 10) {
+        ERROR("Failed to open shared memory \"%s\".", name_.c_str());
+        return false;
+      }
+      usleep(10000);
+    }
+  }
+
+  addr_ = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr_ == MAP_FAILED) {
+    ERROR("Failed to map shared memory \"%s\".", name_.c_str());
+    addr_ = nullptr;
+    shm_unlink(name_.c_str());
+    return false;
+  }
+
+  char* base = static_cast<char*>(addr_);
+  pids_ = reinterpret_cast<std::atomic<int>*>(base + pids_offset);
+  llhs_ = reinterpret_cast<double*>(base + llhs_offset);
+  topics_count_ =
+      reinterpret_cast<std::atomic<int>*>(base + topics_count_offset);
+  delta_sizes_ = reinterpret_cast<int*>(base + delta_sizes_offset);
+  deltas_.resize(processes);
+  for (int p = 0; p < processes; p++) {
+    deltas_[p] = reinterpret_cast<CountDelta*>(base + deltas_offsets[p]);
+  }
+
+  if (process_id == 0) {
+    // "ftruncate" has zero filled the segment
+    header_ = new (base + header_offset) Header;
+    header_->version = kVersion;
+    header_->processes = processes;
+    header_->V = V;
+    header_->K = K;
+    header_->barrier_count.store(0);
+    header_->barrier_generation.store(0);
+    header_->failed.store(0);
+    for (int p = 0; p < processes; p++) {
+      new (&pids_[p]) std::atomic<int>(0);
+    }
+    pids_[0].store(static_cast<int>(getpid()));
+    for (int k = 0; k < K; k++) {
+      new (&topics_count_[k]) std::atomic<int>(0);
+    }
+    header_->magic.store(kMagic, std::memory_order_release);
+  } else {
+    header_ = reinterpret_cast<Header*>(base + header_offset);
+    for (int i = 0; header_->magic.load(std::memory_order_acquire) != kMagic;
+         i++) {
+      if (i == kOpenTimeout / 10) {
+        ERROR("Shared memory \"%s\" is not initialized.", name_.c_str());
+        shm_unlink(name_.c_str());
+        Close();
+        return false;
+      }
+      usleep(10000);
+    }
+    if (header_->version != kVersion || header_->processes != processes ||
+        header_->V != V || header_->K != K) {
+      ERROR("Shared memory \"%s\" mismatches this process.", name_.c_str());
+      Fail();
+      Close();
+      return false;
+    }
+    pids_[process_id].store(static_cast<int>(getpid()));
+  }
+
+  INFO("Process %d/%d attached to shared memory \"%s\" of %zu bytes.",
+       process_id, processes, name_.c_str(), size_);
+  if (!Barrier(kOpenTimeout)) {
+    Close();
+    return false;
+  }
+  if (process_id == 0) {
+    // all attached, the segment is released with the last mapping
+    shm_unlink(name_.c_str());
+  }
+  return true;
+}
+
+void ShmSync::Close() {
+  if (addr_) {
+    munmap(addr_, size_);
+    addr_ = nullptr;
+    header_ = nullptr;
+  }
+}
+
+bool ShmSync::Barrier(int timeout) {
+  const int generation =
+      header_->barrier_generation.load(std::memory_order_acquire);
+  if (header_->barrier_count.fetch_add(1, std::memory_order_acq_rel) + 1 ==
+      processes_) {
+    header_->barrier_count.store(0, std::memory_order_relaxed);
+    header_->barrier_generation.store(generation + 1,
+                                      std::memory_order_release);
+    return true;
+  }
+
+  const auto begin = std::chrono::steady_clock::now();
+  for (int i = 0; header_->barrier_generation.load(std::memory_order_acquire) ==
+                  generation;
+       i++) {
+    if (i < 1000) {
+      sched_yield();
+      continue;
+    }
+    usleep(1000);
+    // check about every 100ms
+    if (i % 100 != 0) {
+      continue;
+    }
+    if (!Alive()) {
+      Fail();
+      return false;
+    }
+    if (timeout >= 0 &&
+        std::chrono::steady_clock::now() - begin >
+            std::chrono::milliseconds(timeout)) {
+      ERROR("Not all processes arrived at shared memory \"%s\" in %dms.",
+            name_.c_str(), timeout);
+      Fail();
+      return false;
+    }
+  }
+  return true;
+}
+
+bool ShmSync::Alive() const {
+  if (header_->failed.load(std::memory_order_acquire)) {
+    ERROR("Another process using shared memory \"%s\" failed.",
+          name_.c_str());
+    return false;
+  }
+  for (int p = 0; p < processes_; p++) {
+    // 0 if the process has not attached yet
+    const int pid = pids_[p].load(std::memory_order_acquire);
+    if (pid != 0 && kill(pid, 0) == -1 && errno == ESRCH) {
+      ERROR("Process %d using shared memory \"%s\" exited.", p,
+            name_.c_str());
+      return false;
+    }
+  }
+  return true;
+}
+
+void ShmSync::Fail() {
+  header_->failed.store(1, std::memory_order_release);
+  // it may have been unlinked
+  shm_unlink(name_.c_str());
+}
+#endif
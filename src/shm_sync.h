@@ -0,0 +1,78 @@
+// Copyright (c) 2017 Contibutors.
+// Author: Yafei Zhang (zhangyafeikimi@gmail.com)
+//
+// count synchronization among processes through POSIX shared memory
+//
+
+#ifndef SHM_SYNC_H_
+#define SHM_SYNC_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <string>
+#include <vector>
+
+struct CountDelta {
+  int v;
+  int k;
+  int count;
+};
+
+// A shared memory segment used by "processes" processes, which holds:
+// the global topic counts,
+// a count delta buffer for each process,
+// a log likelihood slot for each process,
+// the pid of each process,
+// and a barrier.
+// Process 0 creates the segment, others attach to it.
+// A run fails as a whole: if a process fails or exits, or not all of them
+// arrive at the first barrier in 60s, the others fail at their barriers,
+// and the segment is unlinked.
+class ShmSync {
+ private:
+  struct Header;
+
+  std::string name_;
+  int process_id_;
+  int processes_;
+  void* addr_;
+  size_t size_;
+  Header* header_;
+  std::atomic<int>* pids_;
+  double* llhs_;
+  std::atomic<int>* topics_count_;
+  int* delta_sizes_;
+  std::vector<CountDelta*> deltas_;
+  std::vector<int> capacities_;
+
+  // "timeout" in milliseconds, -1 for no timeout
+  bool Barrier(int timeout);
+  // return false if the run has failed or a process has exited
+  bool Alive() const;
+  // mark the run failed, and unlink the segment
+  void Fail();
+
+ public:
+  ShmSync();
+  ~ShmSync();
+
+  int process_id() const { return process_id_; }
+  int processes() const { return processes_; }
+
+  // "capacities[p]": max number of deltas pushed by process "p" at a time
+  bool Open(const std::string& name, int process_id, int processes, int V,
+            int K, const std::vector<int>& capacities);
+  void Close();
+
+  // Wait until all processes arrive,
+  // return false if the run fails.
+  bool Barrier() { return Barrier(-1); }
+
+  std::atomic<int>* topics_count() { return topics_count_; }
+  double& llh(int p) { return llhs_[p]; }
+  int capacity(int p) const { return capacities_[p]; }
+  int& delta_size(int p) { return delta_sizes_[p]; }
+  CountDelta* deltas(int p) { return deltas_[p]; }
+};
+
+#endif  // SHM_SYNC_H_
@@ -7,10 +7,14 @@
 #ifndef TABLE_H_
 #define TABLE_H_
 
+#include <stdint.h>
+#include <string.h>
 #include <algorithm>
+#include <deque>
 #include <fstream>
 #include <string>
 #include <vector>
+#include "arena.h"
 #include "x.h"
 
 template <typename T>
@@ -19,7 +23,12 @@ class DenseTableT {
   typedef T ElementType;
   DenseTableT() {}
 
-  void Init(int hint_size) { storage_.resize(hint_size); }
+  // Reset to "hint_size" zero counts in "arena".
+  void Init(int hint_size, RowArena* arena = nullptr) {
+    storage_ = Storage(hint_size, 0, ArenaAllocator<T>(arena));
+  }
+  RowArena* arena() const { return storage_.get_allocator().arena(); }
+  void Reserve(int size) {}
   ElementType Inc(int id, ElementType count) { return storage_[id] += count; }
   ElementType Dec(int id, ElementType count) { return storage_[id] -= count; }
   ElementType Count(int id) const { return storage_[id]; }
@@ -45,16 +54,185 @@ class DenseTableT {
   ElementType operator[](int id) const { return storage_[id]; }
 
  private:
-  std::vector<ElementType> storage_;
+  typedef std::vector<ElementType, ArenaAllocator<ElementType> > Storage;
+  Storage storage_;
+};
+
+// Dense counts stored in 1, 2 or 4 bytes,
+// all counts of a row are widened when one of them overflows.
+// Most counts of documents and rare words fit in 1 byte.
+// A count is accessed by loading the 4 bytes at it and masking,
+// so the row is written by one thread at a time, like other rows.
+#if defined __BYTE_ORDER__ && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "NarrowDenseTableT requires a little endian CPU."
+#endif
+template <typename T>
+class NarrowDenseTableT {
+ public:
+  typedef T ElementType;
+  static_assert(sizeof(ElementType) == 4, "32 bits counts are required");
+
+  NarrowDenseTableT() : mask_(0xff), shift_(0) {}
+
+  // Reset to "hint_size" zero counts of 1 byte in "arena",
+  // an empty row allocates nothing.
+  void Init(int hint_size, RowArena* arena = nullptr) {
+    SetWidth(1);
+    const ArenaAllocator<uint8_t> allocator(arena);
+    if (hint_size == 0) {
+      storage_ = Storage(allocator);
+    } else {
+      storage_ = Storage(hint_size + kPadding, 0, allocator);
+    }
+  }
+  RowArena* arena() const { return storage_.get_allocator().arena(); }
+  void Reserve(int size) {}
+
+  ElementType Inc(int id, ElementType count) {
+    DCHECK(count >= 0);
+    uint8_t* p = &storage_[static_cast<size_t>(id) << shift_];
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    const uint32_t new_count = (word & mask_) + static_cast<uint32_t>(count);
+    if (new_count > mask_) {
+      Widen(new_count > 0xffff ? 4 : 2);
+      return Inc(id, count);
+    }
+    word = (word & ~mask_) | new_count;
+    memcpy(p, &word, sizeof(word));
+    return static_cast<ElementType>(new_count);
+  }
+
+  ElementType Dec(int id, ElementType count) {
+    uint8_t* p = &storage_[static_cast<size_t>(id) << shift_];
+    uint32_t word;
+    memcpy(&word, p, sizeof(word));
+    const uint32_t new_count = (word & mask_) - static_cast<uint32_t>(count);
+    DCHECK(new_count <= mask_);
+    word = (word & ~mask_) | new_count;
+    memcpy(p, &word, sizeof(word));
+    return static_cast<ElementType>(new_count);
+  }
+
+  ElementType Count(int id) const {
+    uint32_t word;
+    memcpy(&word, &storage_[static_cast<size_t>(id) << shift_], sizeof(word));
+    return static_cast<ElementType>(word & mask_);
+  }
+
+  int NextNonZeroCountIndex(int index) const {
+    switch (shift_) {
+      case 0:
+        return NextNonZeroCountIndex(storage_.data(), index);
+      case 1:
+        return NextNonZeroCountIndex(data<uint16_t>(), index);
+      default:
+        return NextNonZeroCountIndex(data<uint32_t>(), index);
+    }
+  }
+
+  // the size is kept by "storage_" to keep rows small
+  int Size() const {
+    return storage_.empty()
+               ? 0
+               : static_cast<int>((storage_.size() - kPadding) >> shift_);
+  }
+  bool empty() const { return storage_.empty(); }
+  int GetID(int index) const { return index; }
+  ElementType GetCount(int index) const { return Count(index); }
+
+  // "counts[id] = Count(id) + base" for all ids
+  void GetCounts(double base, double* counts) const {
+    switch (shift_) {
+      case 0:
+        GetCounts(storage_.data(), base, counts);
+        break;
+      case 1:
+        GetCounts(data<uint16_t>(), base, counts);
+        break;
+      default:
+        GetCounts(data<uint32_t>(), base, counts);
+        break;
+    }
+  }
+
+ private:
+  typedef std::vector<uint8_t, ArenaAllocator<uint8_t> > Storage;
+
+  // bytes after the last count, which is loaded as 4 bytes
+  static const int kPadding = 3;
+
+  Storage storage_;
+  uint32_t mask_;
+  uint8_t shift_;  // log2 of the width of counts
+
+  void SetWidth(int width) {
+    shift_ = width == 1 ? 0 : (width == 2 ? 1 : 2);
+    mask_ = width == 1 ? 0xff : (width == 2 ? 0xffff : 0xffffffff);
+  }
+
+  template <typename U>
+  const U* data() const {
+    return reinterpret_cast<const U*>(storage_.data());
+  }
+
+  template <typename U>
+  int NextNonZeroCountIndex(const U* row, int index) const {
+    const int size = Size();
+    while (index < size && row[index] == 0) {
+      index++;
+    }
+    return index < size ? index : size;
+  }
+
+  template <typename U>
+  void GetCounts(const U* row, double base, double* counts) const {
+    const int size = Size();
+    for (int id = 0; id < size; id++) {
+      counts[id] = row[id] + base;
+    }
+  }
+
+  template <typename U>
+  void CopyTo(uint8_t* storage) const {
+    U* row = reinterpret_cast<U*>(storage);
+    const int size = Size();
+    for (int id = 0; id < size; id++) {
+      row[id] = static_cast<U>(Count(id));
+    }
+  }
+
+  void Widen(int width) {
+    Storage new_storage(static_cast<size_t>(Size()) * width + kPadding, 0,
+                        storage_.get_allocator());
+    if (width == 2) {
+      CopyTo<uint16_t>(new_storage.data());
+    } else {
+      CopyTo<uint32_t>(new_storage.data());
+    }
+    new_storage.swap(storage_);
+    SetWidth(width);
+  }
 };
 
+// multiplicative hashing of ids in hash tables
+inline int HashID(int id) {
+  const uint32_t h = static_cast<uint32_t>(id) * 2654435761u;
+  return static_cast<int>(h ^ (h >> 16));
+}
+
 template <typename T>
 class SparseTableT {
  public:
   typedef T ElementType;
   SparseTableT() {}
 
-  void Init(int hint_size) {}
+  // Reset to an empty row in "arena".
+  void Init(int hint_size, RowArena* arena = nullptr) {
+    storage_ = Storage(ArenaAllocator<IDCount>(arena));
+  }
+  RowArena* arena() const { return storage_.get_allocator().arena(); }
+  void Reserve(int size) {}
 
   ElementType Inc(int id, ElementType count) {
     auto it = std::lower_bound(storage_.begin(), storage_.end(), id,
@@ -115,60 +293,298 @@ class SparseTableT {
     bool operator()(int a, const IDCount& b) const { return a < b.id; }
   };
 
-  std::vector<IDCount> storage_;
+  typedef std::vector<IDCount, ArenaAllocator<IDCount> > Storage;
+  Storage storage_;
+};
+
+// A sparse row ordered by descending counts, as in SparseLDA.
+// Scans of the row meet heavy ids first, so most samples stop early.
+// An updated entry moves by swapping with the first (or last) entry of
+// each run of equal counts it passes, which is one swap for +1 or -1,
+// runs are found by binary search.
+// Short rows find ids by linear search, longer rows also keep
+// "index_", an open addressing table from ids to positions.
+template <typename T>
+class CountSortedTableT {
+ public:
+  typedef T ElementType;
+  CountSortedTableT() {}
+
+  // Reset to an empty row in "arena".
+  void Init(int hint_size, RowArena* arena = nullptr) {
+    storage_ = Storage(ArenaAllocator<IDCount>(arena));
+    index_ = Index(ArenaAllocator<int>(arena));
+  }
+  RowArena* arena() const { return storage_.get_allocator().arena(); }
+  void Reserve(int size) {}
+
+  ElementType Inc(int id, ElementType count) {
+    int slot;
+    int pos = Find(id, &slot);
+    if (pos == -1) {
+      IDCount target = {id, 0};
+      storage_.push_back(target);
+      pos = Size() - 1;
+      slot = IndexInsert(pos, slot);
+    }
+    storage_[pos].count += count;
+    pos = MoveForward(pos, slot);
+    return storage_[pos].count;
+  }
+
+  ElementType Dec(int id, ElementType count) {
+    int slot;
+    int pos = Find(id, &slot);
+    if (pos == -1) {
+      DCHECK(0);
+      return -1;
+    }
+    DCHECK(storage_[pos].count >= count);
+    storage_[pos].count -= count;
+    pos = MoveBackward(pos, slot);
+    const ElementType new_count = storage_[pos].count;
+    if (new_count == 0) {
+      // other entries have non-zero counts, so it is the last one
+      DCHECK(pos == Size() - 1);
+      IndexErase(slot);
+      storage_.pop_back();
+    }
+    return new_count;
+  }
+
+  ElementType Count(int id) const {
+    int slot;
+    const int pos = Find(id, &slot);
+    if (pos == -1) {
+      return 0;
+    }
+    DCHECK(storage_[pos].count > 0);
+    return storage_[pos].count;
+  }
+
+  int NextNonZeroCountIndex(int index) const { return index; }
+  int Size() const { return static_cast<int>(storage_.size()); }
+  int GetID(int index) const { return storage_[index].id; }
+  ElementType GetCount(int index) const { return storage_[index].count; }
+
+ private:
+  enum {
+    kLinearSearchSize = 16,
+    kEmptySlot = -1,
+  };
+
+  struct IDCount {
+    int id;
+    ElementType count;
+  };
+
+  typedef std::vector<IDCount, ArenaAllocator<IDCount> > Storage;
+  typedef std::vector<int, ArenaAllocator<int> > Index;
+
+  Storage storage_;
+  Index index_;  // slot -> position in "storage_", empty for short rows
+
+  // Return the position of "id" or -1, and set "slot" to its slot in
+  // "index_", or the empty slot to insert it, or -1 without "index_".
+  int Find(int id, int* slot) const {
+    if (index_.empty()) {
+      *slot = -1;
+      for (int pos = 0, size = Size(); pos < size; pos++) {
+        if (storage_[pos].id == id) {
+          return pos;
+        }
+      }
+      return -1;
+    }
+    *slot = FindSlot(id);
+    return index_[*slot];
+  }
+
+  int FindSlot(int id) const {
+    const int mask = static_cast<int>(index_.size()) - 1;
+    int slot = HashID(id) & mask;
+    for (;;) {
+      const int pos = index_[slot];
+      if (pos == kEmptySlot || storage_[pos].id == id) {
+        return slot;
+      }
+      slot = (slot + 1) & mask;
+    }
+  }
+
+  // Move the entry at "pos", whose count has grown, before smaller counts.
+  int MoveForward(int pos, int slot) {
+    const ElementType count = storage_[pos].count;
+    while (pos > 0 && storage_[pos - 1].count < count) {
+      const ElementType run_count = storage_[pos - 1].count;
+      const int first = static_cast<int>(
+          std::partition_point(storage_.begin(), storage_.begin() + pos,
+                               [run_count](const IDCount& item) {
+                                 return item.count > run_count;
+                               }) -
+          storage_.begin());
+      Swap(pos, slot, first);
+      pos = first;
+    }
+    return pos;
+  }
+
+  // Move the entry at "pos", whose count has dropped, after larger counts.
+  int MoveBackward(int pos, int slot) {
+    const ElementType count = storage_[pos].count;
+    const int size = Size();
+    while (pos + 1 < size && storage_[pos + 1].count > count) {
+      const ElementType run_count = storage_[pos + 1].count;
+      const int last = static_cast<int>(
+          std::partition_point(storage_.begin() + pos + 1, storage_.end(),
+                               [run_count](const IDCount& item) {
+                                 return item.count >= run_count;
+                               }) -
+          storage_.begin() - 1);
+      Swap(pos, slot, last);
+      pos = last;
+    }
+    return pos;
+  }
+
+  // Swap the entry at "pos", whose slot is "slot", with the one at "other".
+  void Swap(int pos, int slot, int other) {
+    if (slot != -1) {
+      index_[FindSlot(storage_[other].id)] = pos;
+      index_[slot] = other;
+    }
+    std::swap(storage_[pos], storage_[other]);
+  }
+
+  // Index the new entry at "pos", whose empty slot is "slot",
+  // and return its slot.
+  int IndexInsert(int pos, int slot) {
+    const int size = Size();
+    if (index_.empty()) {
+      if (size <= kLinearSearchSize) {
+        return -1;
+      }
+      IndexRebuild(kLinearSearchSize * 4);
+    } else if (size * 2 > static_cast<int>(index_.size())) {
+      IndexRebuild(static_cast<int>(index_.size()) * 2);
+    } else {
+      index_[slot] = pos;
+      return slot;
+    }
+    return FindSlot(storage_[pos].id);
+  }
+
+  // Empty "slot", and shift back following slots of its cluster,
+  // whose home slots are not between the hole and themselves.
+  void IndexErase(int slot) {
+    if (slot == -1) {
+      return;
+    }
+    const int mask = static_cast<int>(index_.size()) - 1;
+    int hole = slot;
+    for (int next = (hole + 1) & mask; index_[next] != kEmptySlot;
+         next = (next + 1) & mask) {
+      const int home = HashID(storage_[index_[next]].id) & mask;
+      if (((next - home) & mask) >= ((next - hole) & mask)) {
+        index_[hole] = index_[next];
+        hole = next;
+      }
+    }
+    index_[hole] = kEmptySlot;
+  }
+
+  void IndexRebuild(int capacity) {
+    Index new_index(capacity, kEmptySlot, index_.get_allocator());
+    new_index.swap(index_);
+    for (int pos = 0, size = Size(); pos < size; pos++) {
+      index_[FindSlot(storage_[pos].id)] = pos;
+    }
+  }
 };
 
+// An open addressing hash table with linear probing.
+// The capacity is a power of 2 and stays between 2 and 8 times the
+// number of ids, as probes of linear probing lengthen quickly above
+// load 1/2. Ids whose counts drop to 0 are removed by backward shift,
+// so there are no tombstones.
 template <typename T>
 class HashTableT {
  public:
   typedef T ElementType;
-  HashTableT() : used_(0), deleted_(0) { storage_.resize(NextPrime(0)); }
+  HashTableT() : used_(0), hint_size_(0) {}
+
+  // Reset to an empty row in "arena", which has ids in [0, hint_size),
+  // storage is allocated by the first "Inc".
+  void Init(int hint_size, RowArena* arena = nullptr) {
+    used_ = 0;
+    hint_size_ = hint_size;
+    storage_ = Storage(ArenaAllocator<Item>(arena));
+  }
+  RowArena* arena() const { return storage_.get_allocator().arena(); }
 
-  void Init(int hint_size) {}
+  // Make room for "size" ids, e.g. the length of a document.
+  void Reserve(int size) {
+    if (hint_size_ > 0 && size > hint_size_) {
+      size = hint_size_;
+    }
+    const int capacity = Capacity(size);
+    if (capacity > Size()) {
+      _Resize(capacity);
+    }
+  }
 
   ElementType Inc(int id, ElementType count) {
+    DCHECK(id != kEmptyID);
+    if (storage_.empty()) {
+      _Resize(kMinCapacity);
+    }
     int pos = _FindIndex(id);
     Item& item = storage_[pos];
-    if (item.flag == kUsed) {
-      item.count += count;
-    } else if (item.flag == kDeleted) {
-      item.flag = kUsed;
-      item.id = id;
-      item.count = count;
-      used_++;
-      deleted_--;
-    } else {
-      item.flag = kUsed;
-      item.id = id;
-      item.count = count;
-      used_++;
-      _Rehash();
+    if (item.id == id) {
+      return item.count += count;
     }
-    return item.count;
+
+    item.id = id;
+    item.count = count;
+    used_++;
+    if (used_ * 2 > Size()) {
+      _Resize(Size() << 1);
+    }
+    return count;
   }
 
   ElementType Dec(int id, ElementType count) {
+    if (storage_.empty()) {
+      DCHECK(0);
+      return -1;
+    }
     int pos = _FindIndex(id);
     Item& item = storage_[pos];
-    if (item.flag == kUsed) {
-      DCHECK(item.count >= count);
-      item.count -= count;
-      if (item.count == 0) {
-        item.flag = kDeleted;
-        used_--;
-        deleted_++;
-      }
-      return item.count;
-    } else {
+    if (item.id != id) {
       DCHECK(0);
       return -1;
     }
+
+    DCHECK(item.count >= count);
+    item.count -= count;
+    if (item.count != 0) {
+      return item.count;
+    }
+
+    _Erase(pos);
+    used_--;
+    if (Size() > kMinCapacity && used_ * 8 < Size()) {
+      _Resize(Size() >> 1);
+    }
+    return 0;
   }
 
   ElementType Count(int id) const {
-    int pos = _FindIndex(id);
-    const Item& item = storage_[pos];
-    if (item.flag == kUsed) {
+    if (storage_.empty()) {
+      return 0;
+    }
+    const Item& item = storage_[_FindIndex(id)];
+    if (item.id == id) {
       DCHECK(item.count > 0);
       return item.count;
     }
@@ -176,123 +592,236 @@ class HashTableT {
   }
 
   int NextNonZeroCountIndex(int index) const {
-    const int size = static_cast<int>(storage_.size());
-    if (index >= size) {
-      return size;
-    }
-
-    while (storage_[index].flag != kUsed) {
+    const int size = Size();
+    while (index < size && storage_[index].id == kEmptyID) {
       index++;
-      if (index >= size) {
-        return size;
-      }
     }
-    return index;
+    return index < size ? index : size;
   }
 
   int Size() const { return static_cast<int>(storage_.size()); }
 
   int GetID(int index) const {
-    DCHECK(storage_[index].flag == kUsed);
+    DCHECK(storage_[index].id != kEmptyID);
     return storage_[index].id;
   }
 
   ElementType GetCount(int index) const {
-    DCHECK(storage_[index].flag == kUsed);
+    DCHECK(storage_[index].id != kEmptyID);
     return storage_[index].count;
   }
 
  private:
-  static int NextPrime(int n) {
-    static const int prime_list[] = {
-        13,       23,       53,        97,        193,     389,     769,
-        1543,     3079,     6151,      12289,     24593,   49157,   98317,
-        196613,   393241,   786433,    1572869,   3145739, 6291469, 12582917,
-        25165843, 50331653, 100663319, 201326611,
-    };
-    static const int prime_list_size =
-        sizeof(prime_list) / sizeof(prime_list[0]);
-
-    const int* first = prime_list;
-    const int* last = prime_list + prime_list_size;
-    const int* pos = std::lower_bound(first, last, n);
-    return pos == last ? (-1) : *pos;
-  }
-
   enum {
-    kUsed,
-    kEmpty,
-    kDeleted,
+    kEmptyID = -1,
+    kMinCapacity = 8,
   };
 
   struct Item {
     int id;
     ElementType count;
-    int flag;
-    Item() : flag(kEmpty) {}
+    Item() : id(kEmptyID), count(0) {}
   };
 
+  typedef std::vector<Item, ArenaAllocator<Item> > Storage;
+
   int used_;
-  int deleted_;
-  std::vector<Item> storage_;
+  int hint_size_;
+  Storage storage_;
 
  private:
-  static int _FindIndex(int id, const std::vector<Item>& storage,
-                        int storage_size) {
-    int pos = id % storage_size;
+  // the smallest capacity holding "size" ids
+  static int Capacity(int size) {
+    int capacity = kMinCapacity;
+    while (capacity < size * 2) {
+      capacity <<= 1;
+    }
+    return capacity;
+  }
+
+  // Return the slot of "id", or the empty slot to insert it.
+  static int _FindIndex(int id, const Storage& storage) {
+    const int mask = static_cast<int>(storage.size()) - 1;
+    int pos = HashID(id) & mask;
     for (;;) {
-      const Item& item = storage[pos];
-      if (item.flag == kUsed || item.flag == kDeleted) {
-        if (item.id == id) {
-          // reuse previous slot
-          return pos;
-        }
-      } else if (item.flag == kEmpty) {
-        // new slot
+      const int slot_id = storage[pos].id;
+      if (slot_id == id || slot_id == kEmptyID) {
         return pos;
       }
+      pos = (pos + 1) & mask;
+    }
+  }
+
+  int _FindIndex(int id) const { return _FindIndex(id, storage_); }
+
+  // Empty slot "pos", and shift back following items of its cluster,
+  // whose home slots are not between "pos" and themselves.
+  void _Erase(int pos) {
+    const int mask = Size() - 1;
+    int hole = pos;
+    for (int next = (pos + 1) & mask; storage_[next].id != kEmptyID;
+         next = (next + 1) & mask) {
+      const int home = HashID(storage_[next].id) & mask;
+      if (((next - home) & mask) >= ((next - hole) & mask)) {
+        storage_[hole] = storage_[next];
+        hole = next;
+      }
+    }
+    storage_[hole] = Item();
+  }
 
-      // linear probe
-      pos++;
-      if (pos >= storage_size) {
-        pos -= storage_size;
+  void _Resize(int capacity) {
+    Storage new_storage(capacity, Item(), storage_.get_allocator());
+    for (const Item& item : storage_) {
+      if (item.id != kEmptyID) {
+        new_storage[_FindIndex(item.id, new_storage)] = item;
       }
     }
-    DCHECK(0);
-    return -1;
+    new_storage.swap(storage_);
   }
+};
+
+// A row in "SparseImpl", e.g. "HashTableT", while few ids have
+// non-zero counts, which is promoted to "NarrowDenseTableT" when they reach
+// 1/kPromoteRatio of "hint_size", and demoted when they drop below
+// 1/kDemoteRatio, the gap keeps a row from switching back and forth.
+// Rows of frequent words are looked up by direct indexing.
+template <typename T, template <typename> class SparseImpl>
+class HybridTableT {
+ public:
+  typedef T ElementType;
+  HybridTableT() : hint_size_(0), non_zero_(0) {}
 
-  int _FindIndex(int id) const {
-    return _FindIndex(id, storage_, static_cast<int>(storage_.size()));
+  void Init(int hint_size, RowArena* arena = nullptr) {
+    hint_size_ = hint_size;
+    non_zero_ = 0;
+    dense_table_.Init(0, arena);
+    sparse_table_.Init(hint_size, arena);
   }
 
-  void _Rehash() {
-    const int storage_size = static_cast<int>(storage_.size());
-    int size = used_ + deleted_;
-    size = size + (size >> 1);  // * 1.5
-    if (size <= storage_size) {
-      return;
+  // Rows large enough to be promoted soon reserve nothing.
+  void Reserve(int size) {
+    if (!dense() && size * kPromoteRatio < hint_size_) {
+      sparse_table_.Reserve(size);
     }
+  }
 
-    int new_storage_size = NextPrime(used_ << 1);
-    std::vector<Item> new_storage(new_storage_size);
+  ElementType Inc(int id, ElementType count) {
+    if (dense()) {
+      const ElementType new_count = dense_table_.Inc(id, count);
+      if (new_count == count) {
+        non_zero_++;
+      }
+      return new_count;
+    }
 
-    for (int i = 0; i < storage_size; i++) {
-      const Item& item = storage_[i];
-      if (item.flag == kUsed) {
-        int index = _FindIndex(item.id, new_storage, new_storage_size);
-        Item& new_item = new_storage[index];
-        new_item.flag = kUsed;
-        new_item.id = item.id;
-        new_item.count = item.count;
+    const ElementType new_count = sparse_table_.Inc(id, count);
+    if (new_count == count) {
+      non_zero_++;
+      if (hint_size_ > 0 && non_zero_ * kPromoteRatio >= hint_size_) {
+        Promote();
       }
     }
+    return new_count;
+  }
 
-    deleted_ = 0;
-    new_storage.swap(storage_);
+  ElementType Dec(int id, ElementType count) {
+    if (dense()) {
+      const ElementType new_count = dense_table_.Dec(id, count);
+      if (new_count == 0) {
+        non_zero_--;
+        if (non_zero_ * kDemoteRatio < hint_size_) {
+          Demote();
+        }
+      }
+      return new_count;
+    }
+
+    const ElementType new_count = sparse_table_.Dec(id, count);
+    if (new_count == 0) {
+      non_zero_--;
+    }
+    return new_count;
+  }
+
+  ElementType Count(int id) const {
+    return dense() ? dense_table_.Count(id) : sparse_table_.Count(id);
+  }
+
+  int NextNonZeroCountIndex(int index) const {
+    return dense() ? dense_table_.NextNonZeroCountIndex(index)
+                   : sparse_table_.NextNonZeroCountIndex(index);
+  }
+
+  int Size() const {
+    return dense() ? dense_table_.Size() : sparse_table_.Size();
+  }
+
+  int GetID(int index) const {
+    return dense() ? dense_table_.GetID(index) : sparse_table_.GetID(index);
+  }
+
+  ElementType GetCount(int index) const {
+    return dense() ? dense_table_.GetCount(index)
+                   : sparse_table_.GetCount(index);
+  }
+
+  bool dense() const { return !dense_table_.empty(); }
+
+  // "counts[id] = Count(id) + base" for ids in [0, hint_size)
+  void GetCounts(double base, double* counts) const {
+    if (dense()) {
+      dense_table_.GetCounts(base, counts);
+      return;
+    }
+    std::fill(counts, counts + hint_size_, base);
+    const int size = sparse_table_.Size();
+    for (int i = sparse_table_.NextNonZeroCountIndex(0); i < size;
+         i = sparse_table_.NextNonZeroCountIndex(i + 1)) {
+      counts[sparse_table_.GetID(i)] += sparse_table_.GetCount(i);
+    }
+  }
+
+ private:
+  enum {
+    kPromoteRatio = 8,
+    kDemoteRatio = 32,
+  };
+
+  // The arena of the row is kept by whichever table holds its counts.
+  void Promote() {
+    RowArena* arena = sparse_table_.arena();
+    dense_table_.Init(hint_size_, arena);
+    const int size = sparse_table_.Size();
+    for (int i = sparse_table_.NextNonZeroCountIndex(0); i < size;
+         i = sparse_table_.NextNonZeroCountIndex(i + 1)) {
+      dense_table_.Inc(sparse_table_.GetID(i), sparse_table_.GetCount(i));
+    }
+    sparse_table_.Init(hint_size_, arena);
+  }
+
+  void Demote() {
+    RowArena* arena = dense_table_.arena();
+    sparse_table_.Init(hint_size_, arena);
+    for (int id = dense_table_.NextNonZeroCountIndex(0); id < hint_size_;
+         id = dense_table_.NextNonZeroCountIndex(id + 1)) {
+      sparse_table_.Inc(id, dense_table_.GetCount(id));
+    }
+    dense_table_.Init(0, arena);
   }
+
+  int hint_size_;
+  int non_zero_;
+  // a dense row has counts in "dense_table_", and it is empty otherwise
+  NarrowDenseTableT<T> dense_table_;
+  SparseImpl<T> sparse_table_;
 };
 
+template <typename T>
+using HybridHashTableT = HybridTableT<T, HashTableT>;
+template <typename T>
+using HybridSparseTableT = HybridTableT<T, SparseTableT>;
+
 template <typename T, template <typename> class TableImpl>
 class TableT : public TableImpl<T> {
  public:
@@ -362,7 +891,7 @@ class TableT : public TableImpl<T> {
     auto first = begin();
     auto last = end();
     for (; first != last; ++first) {
-      ofs << first.id() << ' ' << first.count() << std::endl;
+      ofs << first.id() << ' ' << first.count() << '\n';
     }
     return true;
   }
@@ -373,36 +902,116 @@ class TablesT {
  public:
   typedef typename Table::ElementType ElementType;
   typedef Table TableType;
-  TablesT() : d1_(0), d2_(0) {}
+  TablesT() : d1_(0), d2_(0), base_(nullptr), view_(false) {}
+  ~TablesT() { ClearMatrix(); }
 
   void Init(int d1, int d2) {
     d1_ = d1;
     d2_ = d2;
-    matrix_.clear();
+    base_ = nullptr;
+    view_ = false;
+    ClearMatrix();
     matrix_.resize(d1);
     for (int i = 0; i < d1_; i++) {
-      matrix_[i].Init(d2);
+      matrix_[i].Init(d2, &arena_);
+    }
+  }
+
+  // A shadow reads rows from "base" until a row is accessed non-const,
+  // when the row is copied and modified privately afterwards.
+  // "base" must not be modified until "ClearShadow".
+  void InitShadow(TablesT* base) {
+    d1_ = base->d1_;
+    d2_ = base->d2_;
+    base_ = base;
+    view_ = false;
+    ClearMatrix();
+    shadow_index_.assign(d1_, -1);
+    shadow_rows_.clear();
+    shadow_matrix_.clear();
+  }
+
+  // A view reads and writes rows of "base" directly.
+  // Concurrent views must not access the same row.
+  void InitView(TablesT* base) {
+    d1_ = base->d1_;
+    d2_ = base->d2_;
+    base_ = base;
+    view_ = true;
+    ClearMatrix();
+    shadow_index_.clear();
+    shadow_rows_.clear();
+    shadow_matrix_.clear();
+  }
+
+  // drop all private rows
+  void ClearShadow() {
+    for (int i : shadow_rows_) {
+      shadow_index_[i] = -1;
     }
+    shadow_rows_.clear();
+    shadow_matrix_.clear();
   }
 
+  // rows copied since "InitShadow" or "ClearShadow"
+  const std::vector<int>& shadow_rows() const { return shadow_rows_; }
+
   int d1() const { return d1_; }
   int d2() const { return d2_; }
-  TableType& operator[](int i) { return matrix_[i]; }
-  const TableType& operator[](int i) const { return matrix_[i]; }
 
-  bool Save(const std::string& filename) const {
+  TableType& operator[](int i) {
+    if (base_ == nullptr) {
+      return matrix_[i];
+    }
+    if (view_) {
+      return (*base_)[i];
+    }
+
+    int& index = shadow_index_[i];
+    if (index == -1) {
+      index = static_cast<int>(shadow_matrix_.size());
+      shadow_matrix_.push_back(static_cast<const TablesT&>(*base_)[i]);
+      shadow_rows_.push_back(i);
+    }
+    return shadow_matrix_[index];
+  }
+
+  const TableType& operator[](int i) const {
+    if (base_ == nullptr) {
+      return matrix_[i];
+    }
+    if (view_) {
+      return static_cast<const TablesT&>(*base_)[i];
+    }
+
+    const int index = shadow_index_[i];
+    if (index == -1) {
+      return static_cast<const TablesT&>(*base_)[i];
+    }
+    return shadow_matrix_[index];
+  }
+
+  // Row "i" is saved with id "row_ids[i]" if "row_ids" is not empty.
+  // Rows are saved in ascending order of their ids.
+  bool Save(const std::string& filename,
+            const std::vector<int>& row_ids = std::vector<int>()) const {
     std::ofstream ofs(filename.c_str());
     if (!ofs.is_open()) {
       ERROR("Failed to open \"%s\".", filename.c_str());
       return false;
     }
 
+    std::vector<int> rows(d1_);  // id -> row
     for (int i = 0; i < d1_; i++) {
-      const TableType& table = matrix_[i];
+      rows[row_ids.empty() ? i : row_ids[i]] = i;
+    }
+
+    for (int id = 0; id < d1_; id++) {
+      const TableType& table = (*this)[rows[id]];
       auto first = table.begin();
       auto last = table.end();
       for (; first != last; ++first) {
-        ofs << i << ' ' << first.id() << ' ' << first.count() << std::endl;
+        ofs << id << ' ' << first.id() << ' ' << first.count() << '\n';
       }
     }
     return true;
@@ -411,13 +1020,36 @@ class TablesT {
  private:
   int d1_;
   int d2_;
+  // storage of rows in "matrix_", declared first to be destroyed last
+  RowArena arena_;
   std::vector<TableType> matrix_;
+
+  // shadow or view
+  TablesT* base_;
+  bool view_;
+  std::vector<int> shadow_index_;  // row -> index in "shadow_matrix_"
+  std::vector<int> shadow_rows_;
+  // std::deque keeps references to rows valid when appending
+  std::deque<TableType> shadow_matrix_;
+
+  // destroy rows of "matrix_" and release their arena in bulk
+  void ClearMatrix() {
+    arena_.BeginClear();
+    matrix_.clear();
+    arena_.Clear();
+  }
 };
 
 typedef TableT<int, DenseTableT> DenseTable;
 typedef TableT<int, SparseTableT> SparseTable;
+typedef TableT<int, CountSortedTableT> CountSortedTable;
 typedef TableT<int, HashTableT> HashTable;
+typedef TableT<int, HybridHashTableT> HybridHashTable;
+typedef TableT<int, HybridSparseTableT> HybridSparseTable;
 typedef TablesT<SparseTable> SparseTables;
+typedef TablesT<CountSortedTable> CountSortedTables;
 typedef TablesT<HashTable> HashTables;
+typedef TablesT<HybridHashTable> HybridHashTables;
+typedef TablesT<HybridSparseTable> HybridSparseTables;
 
 #endif  // TABLE_H_